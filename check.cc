@@ -0,0 +1,318 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "simulation.hh"
+#include "snapshot.hh"
+#include "task_pool.hh"
+#include "trajectory.hh"
+
+// Round trips of the checkpoint and trajectory formats in every precision
+// and dimension the engine is built for, plus damaged files that must be
+// rejected. Run by `make check`.
+
+static int check_failures = 0;
+
+static void
+check (bool ok, const std::string &what)
+{
+  if (!ok)
+    {
+      fprintf (stderr, "check: FAILED %s\n", what.c_str ());
+      ++check_failures;
+    }
+}
+
+// Copies the first `size` bytes of `from` to `to`.
+static void
+check_truncate (const std::string &from, const std::string &to,
+                std::size_t size)
+{
+  std::ifstream in (from, std::ios::binary);
+  std::vector<char> bytes (size);
+  in.read (bytes.data (), size);
+  std::ofstream (to, std::ios::binary).write (bytes.data (), in.gcount ());
+}
+
+template <typename T, int D>
+static std::string
+check_label (const char *name)
+{
+  return std::string (name) + (sizeof (T) == 8 ? " double " : " float ")
+         + std::to_string (D) + "D";
+}
+
+template <typename T, int D>
+static void
+check_simulation (bh::simulation_t<T, D> *sim_, bh::task_pool_t *pool,
+                  std::size_t n)
+{
+  bh::simulation_t<T, D> &sim = *sim_;
+  sim.pool = pool;
+  for (int axis = 0; axis < D; ++axis)
+    sim.boundary.corner[axis] = -100;
+  sim.boundary.width = 200;
+  sim.params.theta = 0.7;
+  sim.params.gravity = 2;
+  sim.params.time_step = 0.01;
+  sim.params.softening = 0.5;
+  sim.params.kernel = bh::KERNEL_SPLINE;
+  sim.steps = 42;
+
+  // Velocities are multiples of the trajectory quantum, so they come back
+  // from a trajectory exactly.
+  std::mt19937 random (D * 8 + sizeof (T));
+  std::uniform_real_distribution<double> position (-99, 99);
+  std::uniform_int_distribution<int> velocity (-4096, 4096);
+
+  sim.points.resize (n);
+  for (bh::point_t<T, D> &point : sim.points)
+    {
+      point.mass = static_cast<T> (position (random) + 100);
+      for (int axis = 0; axis < D; ++axis)
+        {
+          point.position[axis] = static_cast<T> (position (random));
+          point.velocity[axis] = static_cast<T> (velocity (random) / 1024.0);
+        }
+    }
+}
+
+template <typename T, int D>
+static bool
+check_same_points (const bh::point_vector_t<T, D> &a,
+                   const bh::point_vector_t<T, D> &b)
+{
+  if (a.size () != b.size ())
+    return false;
+
+  for (std::size_t i = 0; i < a.size (); ++i)
+    {
+      if (a[i].mass != b[i].mass)
+        return false;
+      for (int axis = 0; axis < D; ++axis)
+        if (a[i].position[axis] != b[i].position[axis]
+            || a[i].velocity[axis] != b[i].velocity[axis])
+          return false;
+    }
+
+  return true;
+}
+
+template <typename T, int D>
+static bool
+check_same_state (const bh::simulation_t<T, D> &a,
+                  const bh::simulation_t<T, D> &b)
+{
+  bool same = a.steps == b.steps && a.params.theta == b.params.theta
+              && a.params.gravity == b.params.gravity
+              && a.params.time_step == b.params.time_step
+              && a.params.softening == b.params.softening
+              && a.params.kernel == b.params.kernel
+              && a.boundary.width == b.boundary.width;
+  for (int axis = 0; axis < D; ++axis)
+    same = same && a.boundary.corner[axis] == b.boundary.corner[axis];
+
+  return same && check_same_points (a.points, b.points);
+}
+
+template <typename T, int D>
+static void
+check_snapshot (bh::task_pool_t *pool, const std::string &dir)
+{
+  const std::string label = check_label<T, D> ("checkpoint");
+  const std::string path = dir + "/check.bhs";
+  const std::string damaged = dir + "/damaged.bhs";
+
+  bh::simulation_t<T, D> sim{};
+  check_simulation<T, D> (&sim, pool, 3000);
+
+  const auto load = [&] (const std::string &from) {
+    bh::simulation_t<T, D> loaded{};
+    loaded.pool = pool;
+    return bh::snapshot_load (from.c_str (), &loaded)
+           && check_same_state (sim, loaded);
+  };
+
+  check (bh::snapshot_write (path.c_str (), sim), label + " write");
+  check (load (path), label + " round trip");
+
+  // The background writer stores the same image.
+  bh::snapshot_writer_t *writer = bh::snapshot_writer_init ();
+  bh::snapshot_writer_submit (writer, path.c_str (), sim);
+  bh::snapshot_writer_free (writer);
+  check (load (path), label + " background round trip");
+
+  // Columns are padded to pages, so the last cut drops the final byte of
+  // the last column rather than padding.
+  bh::snapshot_header_t header;
+  check (bh::snapshot_probe (path.c_str (), &header), label + " probe");
+  const std::size_t end
+      = header.columns[2 * D] + sim.points.size () * sizeof (T);
+  for (std::size_t keep :
+       { std::size_t (16), sizeof (header), end / 2, end - 1 })
+    {
+      check_truncate (path, damaged, keep);
+      bh::simulation_t<T, D> loaded{};
+      loaded.pool = pool;
+      check (!bh::snapshot_load (damaged.c_str (), &loaded),
+             label + " truncated to " + std::to_string (keep)
+                 + " bytes is rejected");
+    }
+}
+
+template <typename T, int D>
+static void
+check_trajectory (bh::task_pool_t *pool, const std::string &dir)
+{
+  const std::string label = check_label<T, D> ("trajectory");
+  const std::string path = dir + "/check.traj";
+  const std::string damaged = dir + "/damaged.traj";
+
+  bh::trajectory_options_t options{};
+  options.velocities = true;
+  options.bits = 20;
+  options.velocity_quantum = 1.0 / 1024;
+  options.keyframe_interval = 3;
+  options.chunk_bodies = 1000;
+  options.queue = 16;
+
+  bh::simulation_t<T, D> sim{};
+  check_simulation<T, D> (&sim, pool, 2500);
+  const int frames = 8;
+
+  // Recorded frames, moved a little between pushes so deltas are non-zero.
+  std::vector<bh::point_vector_t<T, D> > recorded;
+  bh::trajectory_writer_t<T, D> *writer
+      = bh::trajectory_writer_init<T, D> (path.c_str (), sim, options);
+  check (writer != NULL, label + " create");
+  if (writer == NULL)
+    return;
+
+  for (int f = 0; f < frames; ++f)
+    {
+      for (std::size_t i = 0; i < sim.points.size (); i += 1 + f)
+        for (int axis = 0; axis < D; ++axis)
+          sim.points[i].position[axis] += static_cast<T> (0.01 * (axis + 1));
+
+      sim.steps = 10 * f;
+      check (bh::trajectory_writer_push (writer, sim),
+             label + " push frame " + std::to_string (f));
+      recorded.push_back (sim.points);
+    }
+  bh::trajectory_writer_free (writer);
+
+  // Positions are quantized to 20 bits across the box; velocities are
+  // multiples of the quantum and come back exactly.
+  const double tolerance
+      = 0.5 * sim.boundary.width / (std::ldexp (1.0, options.bits) - 1)
+        + 4 * std::numeric_limits<T>::epsilon () * sim.boundary.width;
+  const auto matches = [&] (const bh::point_vector_t<T, D> &read,
+                            const bh::point_vector_t<T, D> &expected) {
+    if (read.size () != expected.size ())
+      return false;
+    for (std::size_t i = 0; i < read.size (); ++i)
+      for (int axis = 0; axis < D; ++axis)
+        if (std::abs (double (read[i].position[axis])
+                      - double (expected[i].position[axis]))
+                > tolerance
+            || read[i].velocity[axis] != expected[i].velocity[axis])
+          return false;
+    return true;
+  };
+
+  bh::trajectory_reader_t<T, D> *reader
+      = bh::trajectory_reader_init<T, D> (path.c_str (), pool);
+  check (reader != NULL
+             && bh::trajectory_reader_frames (*reader) == std::size_t (frames),
+         label + " frame count");
+  if (reader == NULL)
+    return;
+
+  std::vector<bh::point_vector_t<T, D> > sequential (frames);
+  for (int f = 0; f < frames; ++f)
+    check (bh::trajectory_reader_read (reader, f, &sequential[f])
+               && matches (sequential[f], recorded[f])
+               && bh::trajectory_reader_step (*reader, f)
+                      == std::uint64_t (10 * f),
+           label + " sequential frame " + std::to_string (f));
+
+  // Frames rebuilt from their keyframe decode to the same bits as frames
+  // reached one delta at a time.
+  for (int f : { 5, 1, 7, 4 })
+    {
+      bh::point_vector_t<T, D> points{};
+      check (bh::trajectory_reader_read (reader, f, &points)
+                 && check_same_points (points, sequential[f]),
+             label + " random frame " + std::to_string (f));
+    }
+  bh::trajectory_reader_free (reader);
+
+  // Without its index, a cut trajectory keeps only its whole frames.
+  check_truncate (path, damaged, std::filesystem::file_size (path) / 2);
+  reader = bh::trajectory_reader_init<T, D> (damaged.c_str (), pool);
+  check (reader != NULL, label + " truncated open");
+  if (reader != NULL)
+    {
+      const std::size_t kept = bh::trajectory_reader_frames (*reader);
+      check (kept < std::size_t (frames), label + " truncated frame count");
+      for (std::size_t f = 0; f < kept; ++f)
+        {
+          bh::point_vector_t<T, D> points{};
+          check (bh::trajectory_reader_read (reader, f, &points)
+                     && check_same_points (points, sequential[f]),
+                 label + " truncated frame " + std::to_string (f));
+        }
+      bh::trajectory_reader_free (reader);
+    }
+
+  check_truncate (path, damaged, sizeof (bh::trajectory_header_t) - 1);
+  reader = bh::trajectory_reader_init<T, D> (damaged.c_str (), pool);
+  check (reader == NULL, label + " cut header is rejected");
+  bh::trajectory_reader_free (reader);
+}
+
+template <typename T, int D>
+static void
+check_formats (bh::task_pool_t *pool, const std::string &dir)
+{
+  check_snapshot<T, D> (pool, dir);
+  check_trajectory<T, D> (pool, dir);
+}
+
+int
+main ()
+{
+  const std::filesystem::path tmp = std::filesystem::temp_directory_path ();
+  std::string dir = (tmp / "bh-check-XXXXXX").string ();
+  if (mkdtemp (dir.data ()) == NULL)
+    {
+      fprintf (stderr, "check: cannot create a directory in %s\n",
+               tmp.c_str ());
+      return 1;
+    }
+
+  bh::task_pool_t *pool = bh::task_pool_init (4, false);
+
+  check_formats<float, 2> (pool, dir);
+  check_formats<float, 3> (pool, dir);
+  check_formats<double, 2> (pool, dir);
+  check_formats<double, 3> (pool, dir);
+
+  bh::task_pool_free (pool);
+  std::filesystem::remove_all (dir);
+
+  if (check_failures > 0)
+    {
+      fprintf (stderr, "check: %d failed\n", check_failures);
+      return 1;
+    }
+
+  printf ("check: all passed\n");
+  return 0;
+}
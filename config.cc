@@ -0,0 +1,411 @@
+#include "config.hh"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace bh
+{
+
+struct config_option_t
+{
+  const char *name;
+
+  // Placeholder of the value in the usage, or NULL for flags, which their
+  // bare name on the command line switches on.
+  const char *argument;
+  const char *help;
+
+  bool (*set) (bh::config_t *config, const char *value);
+};
+
+static bool
+config_int (const char *value, int *out, int min)
+{
+  char *end;
+  errno = 0;
+  const long v = std::strtol (value, &end, 10);
+  if (errno != 0 || end == value || *end != '\0' || v < min || v > 1 << 30)
+    return false;
+
+  return *out = static_cast<int> (v), true;
+}
+
+static bool
+config_u64 (const char *value, std::uint64_t *out)
+{
+  char *end;
+  errno = 0;
+  const unsigned long long v = std::strtoull (value, &end, 10);
+  if (errno != 0 || end == value || *end != '\0')
+    return false;
+
+  return *out = v, true;
+}
+
+template <typename F>
+static bool
+config_real (const char *value, F *out, bool positive)
+{
+  char *end;
+  errno = 0;
+  const double v = std::strtod (value, &end);
+  if (errno != 0 || end == value || *end != '\0' || v < 0
+      || (positive && !(v > 0)))
+    return false;
+
+  return *out = static_cast<F> (v), true;
+}
+
+static bool
+config_bool (const char *value, bool *out)
+{
+  if (std::strcmp (value, "1") == 0 || std::strcmp (value, "true") == 0
+      || std::strcmp (value, "yes") == 0 || std::strcmp (value, "on") == 0)
+    return *out = true, true;
+
+  if (std::strcmp (value, "0") == 0 || std::strcmp (value, "false") == 0
+      || std::strcmp (value, "no") == 0 || std::strcmp (value, "off") == 0)
+    return *out = false, true;
+
+  return false;
+}
+
+static const bh::config_option_t CONFIG_OPTIONS[] = {
+  { "3d", NULL, "use the 3D octree",
+    [] (bh::config_t *c, const char *v) {
+      bool on;
+      return bh::config_bool (v, &on) && (c->dimension = on ? 3 : 2, true);
+    } },
+  { "double", NULL, "compute in double precision",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_bool (v, &c->double_precision);
+    } },
+  { "bodies", "N", "bodies of a generated galaxy",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->bodies, 1);
+    } },
+  { "seed", "N", "seed of a generated galaxy",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_u64 (v, &c->seed);
+    } },
+  { "scenario", "NAME", "disk, plummer, milky-way or collision",
+    [] (bh::config_t *c, const char *v) { return c->scenario = v, true; } },
+  { "initial", "FILE", "initial conditions, text or .f32/.f64 columns",
+    [] (bh::config_t *c, const char *v) { return c->initial = v, true; } },
+  { "restart", "FILE", "checkpoint to continue from",
+    [] (bh::config_t *c, const char *v) { return c->restart = v, true; } },
+  { "box", "L", "half the edge of the root cell",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_real (v, &c->box, true);
+    } },
+  { "theta", "X", "opening angle, 0 for direct summation",
+    [] (bh::config_t *c, const char *v) {
+      c->params_set |= bh::PARAM_THETA;
+      return bh::config_real (v, &c->params.theta, false);
+    } },
+  { "gravity", "G", "gravitational constant",
+    [] (bh::config_t *c, const char *v) {
+      c->params_set |= bh::PARAM_GRAVITY;
+      return bh::config_real (v, &c->params.gravity, false);
+    } },
+  { "time-step", "DT", "integration time step",
+    [] (bh::config_t *c, const char *v) {
+      c->params_set |= bh::PARAM_TIME_STEP;
+      return bh::config_real (v, &c->params.time_step, false);
+    } },
+  { "softening", "EPS", "Plummer-equivalent softening length",
+    [] (bh::config_t *c, const char *v) {
+      c->params_set |= bh::PARAM_SOFTENING;
+      return bh::config_real (v, &c->params.softening, false);
+    } },
+  { "kernel", "plummer|spline", "softening kernel",
+    [] (bh::config_t *c, const char *v) {
+      c->params_set |= bh::PARAM_KERNEL;
+      if (std::strcmp (v, "plummer") == 0)
+        return c->params.kernel = bh::KERNEL_PLUMMER, true;
+      if (std::strcmp (v, "spline") == 0)
+        return c->params.kernel = bh::KERNEL_SPLINE, true;
+      return false;
+    } },
+  { "steps", "N", "steps of a headless run",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->steps, 0);
+    } },
+  { "diagnostics", NULL, "log energy, momenta and virial ratio each step",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_bool (v, &c->diagnostics);
+    } },
+  { "threads", "N", "pool threads, 0 for all hardware threads",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->threads, 0);
+    } },
+  { "pin-threads", NULL, "pin pool threads, needed for NUMA placement",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_bool (v, &c->pin_threads);
+    } },
+  { "checkpoint", "FILE", "checkpoint to rewrite periodically",
+    [] (bh::config_t *c, const char *v) { return c->checkpoint = v, true; } },
+  { "checkpoint-every", "N", "steps between checkpoints",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->checkpoint_every, 1);
+    } },
+  { "trajectory", "FILE", "trajectory to record",
+    [] (bh::config_t *c, const char *v) { return c->trajectory = v, true; } },
+  { "trajectory-every", "N", "steps between recorded frames",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->trajectory_every, 1);
+    } },
+  { "trajectory-velocities", NULL, "record velocities too",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_bool (v, &c->trajectory_velocities);
+    } },
+  { "trajectory-bits", "N", "bits per recorded coordinate",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->trajectory_bits, 1)
+             && c->trajectory_bits <= 32;
+    } },
+  { "replay", "FILE", "trajectory to play back (viewer)",
+    [] (bh::config_t *c, const char *v) { return c->replay = v, true; } },
+  { "frames", "PATTERN", "movie frames, %d.ppm files or raw RGB to |CMD",
+    [] (bh::config_t *c, const char *v) { return c->frames = v, true; } },
+  { "frames-every", "N", "steps between movie frames",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->frames_every, 1);
+    } },
+  { "frame-scale", "X", "world units per movie frame pixel",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_real (v, &c->frame_scale, true);
+    } },
+  { "render-threads", "N",
+    "vertex threads, 0 for --threads; frame threads, 0 for 2",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->render_threads, 0);
+    } },
+  { "color", "QUANTITY", "plain, speed, acceleration, density or cost",
+    [] (bh::config_t *c, const char *v) {
+      static const char *const names[] = { "plain", "speed", "acceleration",
+                                           "density", "cost" };
+      for (int k = 0; k < 5; ++k)
+        if (std::strcmp (v, names[k]) == 0)
+          return c->color = static_cast<bh::color_t> (k), true;
+      return false;
+    } },
+  { "tree-overlay", NULL, "outline tree nodes by force cost (viewer)",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_bool (v, &c->tree_overlay);
+    } },
+  { "tree-depth", "N", "levels of the tree overlay",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->tree_depth, 0);
+    } },
+  { "density", NULL, "draw a tone-mapped density map (viewer)",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_bool (v, &c->density);
+    } },
+  { "tone", "log|asinh", "tone curve of the density map",
+    [] (bh::config_t *c, const char *v) {
+      if (std::strcmp (v, "log") == 0)
+        return c->tone = bh::DENSITY_LOG, true;
+      if (std::strcmp (v, "asinh") == 0)
+        return c->tone = bh::DENSITY_ASINH, true;
+      return false;
+    } },
+  { "softness", "X", "density where the tone curve bends, 0 for the mean",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_real (v, &c->softness, false);
+    } },
+  { "hud", NULL, "show the performance graphs (viewer)",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_bool (v, &c->hud);
+    } },
+  { "window-width", "PX", "window or movie frame width",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->window_width, 1);
+    } },
+  { "window-height", "PX", "window or movie frame height",
+    [] (bh::config_t *c, const char *v) {
+      return bh::config_int (v, &c->window_height, 1);
+    } },
+};
+
+static const bh::config_option_t *
+config_find (const char *key, std::size_t length)
+{
+  for (const auto &option : bh::CONFIG_OPTIONS)
+    if (std::strlen (option.name) == length
+        && std::strncmp (option.name, key, length) == 0)
+      return &option;
+
+  return NULL;
+}
+
+bool
+config_set (bh::config_t *config, const char *key, const char *value)
+{
+  const bh::config_option_t *option = bh::config_find (key, std::strlen (key));
+  if (option == NULL)
+    {
+      fprintf (stderr, "config: unknown option %s\n", key);
+      return false;
+    }
+
+  if (!option->set (config, value))
+    {
+      fprintf (stderr, "config: bad value '%s' for %s\n", value, key);
+      return false;
+    }
+
+  return true;
+}
+
+static char *
+config_trim (char *s)
+{
+  while (*s == ' ' || *s == '\t')
+    ++s;
+
+  char *end = s + std::strlen (s);
+  while (end > s
+         && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'
+             || end[-1] == '\n'))
+    --end;
+
+  return *end = '\0', s;
+}
+
+bool
+config_load (bh::config_t *config, const char *path)
+{
+  FILE *file = std::fopen (path, "r");
+  if (file == NULL)
+    {
+      fprintf (stderr, "config: cannot open %s\n", path);
+      return false;
+    }
+
+  bool ok = true;
+  char line[4096];
+  for (int number = 1; ok && std::fgets (line, sizeof (line), file) != NULL;
+       ++number)
+    {
+      if (char *comment = std::strchr (line, '#'))
+        *comment = '\0';
+
+      char *key = bh::config_trim (line);
+      if (*key == '\0')
+        continue;
+
+      char *equals = std::strchr (key, '=');
+      if (equals == NULL)
+        {
+          fprintf (stderr, "config: %s:%d: expected key = value\n", path,
+                   number);
+          ok = false;
+          break;
+        }
+
+      *equals = '\0';
+      ok = bh::config_set (config, bh::config_trim (key),
+                           bh::config_trim (equals + 1));
+      if (!ok)
+        fprintf (stderr, "config: in %s:%d\n", path, number);
+    }
+
+  std::fclose (file);
+  return ok;
+}
+
+bool
+config_parse (bh::config_t *config, int argc, char **argv)
+{
+  for (int i = 1; i < argc; ++i)
+    {
+      const char *arg = argv[i];
+      if (std::strncmp (arg, "--", 2) != 0)
+        {
+          fprintf (stderr, "config: unexpected argument %s\n", arg);
+          return false;
+        }
+
+      const char *key = arg + 2;
+      const char *equals = std::strchr (key, '=');
+      const std::size_t length
+          = equals != NULL ? std::size_t (equals - key) : std::strlen (key);
+
+      if (length == 6 && std::strncmp (key, "config", 6) == 0)
+        {
+          const char *path = equals != NULL ? equals + 1
+                             : i + 1 < argc ? argv[++i]
+                                            : NULL;
+          if (path == NULL || !bh::config_load (config, path))
+            return false;
+          continue;
+        }
+
+      const bh::config_option_t *option = bh::config_find (key, length);
+      if (option == NULL && std::strcmp (key, "help") == 0)
+        return false;
+
+      if (option == NULL)
+        {
+          fprintf (stderr, "config: unknown option --%.*s\n", int (length),
+                   key);
+          return false;
+        }
+
+      const char *value = equals != NULL ? equals + 1
+                          : option->argument == NULL ? "true"
+                          : i + 1 < argc ? argv[++i]
+                                         : NULL;
+      if (value == NULL)
+        {
+          fprintf (stderr, "config: --%s needs a value\n", option->name);
+          return false;
+        }
+
+      if (!option->set (config, value))
+        {
+          fprintf (stderr, "config: bad value '%s' for --%s\n", value,
+                   option->name);
+          return false;
+        }
+    }
+
+  return true;
+}
+
+void
+config_apply_params (const bh::config_t &config, bh::params_t *params)
+{
+  const unsigned set = config.params_set;
+  if (set & bh::PARAM_THETA)
+    params->theta = config.params.theta;
+  if (set & bh::PARAM_GRAVITY)
+    params->gravity = config.params.gravity;
+  if (set & bh::PARAM_TIME_STEP)
+    params->time_step = config.params.time_step;
+  if (set & bh::PARAM_SOFTENING)
+    params->softening = config.params.softening;
+  if (set & bh::PARAM_KERNEL)
+    params->kernel = config.params.kernel;
+}
+
+void
+config_usage (FILE *out, const char *program)
+{
+  fprintf (out, "usage: %s [--config FILE] [--option VALUE]...\n\n", program);
+  fprintf (out, "Options may also be given as `option = value` lines in a "
+                "config file.\n\n");
+
+  for (const auto &option : bh::CONFIG_OPTIONS)
+    {
+      const std::string usage
+          = std::string (option.name)
+            + (option.argument != NULL ? std::string (" ") + option.argument
+                                       : std::string ());
+      fprintf (out, "  --%-28s %s\n", usage.c_str (), option.help);
+    }
+}
+
+}
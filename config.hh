@@ -0,0 +1,128 @@
+#ifndef BH_CONFIG_HH
+#define BH_CONFIG_HH
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "density.hh"
+#include "force.hh"
+
+namespace bh
+{
+
+// Per-body quantity the viewer colours bodies by.
+enum color_t
+{
+  COLOR_PLAIN,
+  COLOR_SPEED,
+  COLOR_ACCELERATION,
+  COLOR_DENSITY,
+  COLOR_COST,
+};
+
+// Members of `params_t`, as bits of `config_t::params_set`.
+enum param_bit_t
+{
+  PARAM_THETA = 1 << 0,
+  PARAM_GRAVITY = 1 << 1,
+  PARAM_TIME_STEP = 1 << 2,
+  PARAM_SOFTENING = 1 << 3,
+  PARAM_KERNEL = 1 << 4,
+};
+
+// Everything a run can be set up with. The viewer and the headless runner
+// read the same options; each ignores the ones it has no use for.
+struct config_t
+{
+  // Precision and dimension the engine is instantiated for.
+  int dimension{ 2 };
+  bool double_precision{ false };
+
+  // Initial conditions: a checkpoint, a file, a scenario preset, or else the
+  // default disk of `bodies` bodies.
+  int bodies{ 100'000 };
+  std::uint64_t seed{ 1 };
+  std::string restart{};
+  std::string initial{};
+  std::string scenario{};
+
+  // Half the edge of the root cell, centred on the origin.
+  double box{ 160000 };
+
+  bh::params_t params{};
+
+  // Members of `params` given explicitly, `param_bit_t`s, which a restart
+  // applies over the ones saved in the checkpoint.
+  unsigned params_set{ 0 };
+
+  int steps{ 100 };
+
+  // Log energies, momenta and the virial ratio every step.
+  bool diagnostics{ false };
+
+  // Pool threads, or 0 for one per hardware thread.
+  int threads{ 0 };
+  bool pin_threads{ false };
+
+  std::string checkpoint{};
+  int checkpoint_every{ 100 };
+
+  std::string trajectory{};
+  int trajectory_every{ 1 };
+  bool trajectory_velocities{ false };
+  int trajectory_bits{ 24 };
+
+  std::string replay{};
+
+  // Movie frames of a headless run: an image pattern or `|command`, see
+  // frames.hh. They are window-sized, `frame_scale` world units per pixel.
+  std::string frames{};
+  int frames_every{ 1 };
+  double frame_scale{ 1.5 };
+
+  // Threads that prepare the viewer's vertices or rasterize movie frames,
+  // or 0 for as many as the solver has.
+  int render_threads{ 0 };
+
+  bh::color_t color{ bh::COLOR_PLAIN };
+
+  // Outline the last step's tree down to `tree_depth` levels, coloured by
+  // the force cost of each subtree.
+  bool tree_overlay{ false };
+  int tree_depth{ 16 };
+
+  // Draw a tone-mapped density map instead of points.
+  bool density{ false };
+  bh::density_tone_t tone{ bh::DENSITY_ASINH };
+  float softness{ 0 };
+
+  // Show the performance HUD.
+  bool hud{ true };
+
+  int window_width{ 800 };
+  int window_height{ 800 };
+};
+
+// Sets option `key` from its textual `value`. Returns false, after saying
+// why on stderr, if the key is unknown or the value does not parse.
+bool config_set (bh::config_t *config, const char *key, const char *value);
+
+// Reads `key = value` lines from `path`. Blank lines and everything after a
+// `#` are ignored.
+bool config_load (bh::config_t *config, const char *path);
+
+// Applies `--key value`, `--key=value` and bare `--flag` arguments in
+// order; `--config FILE` loads a file at that point, so later arguments
+// override it.
+bool config_parse (bh::config_t *config, int argc, char **argv);
+
+// Overwrites the members of `params` given explicitly in `config`, as after
+// a restart has loaded the checkpoint's own.
+void config_apply_params (const bh::config_t &config, bh::params_t *params);
+
+void config_usage (FILE *out, const char *program);
+
+}
+
+#endif
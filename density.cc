@@ -0,0 +1,200 @@
+#include "density.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bh
+{
+
+// Private grids of all tasks together stay below this many bytes; beyond
+// it, fewer tasks deposit more bodies each.
+static const std::size_t DENSITY_SCRATCH_BYTES = std::size_t{ 64 } << 20;
+
+// Palette stops from empty to densest: the background, the body colour of
+// the point renderer, then near white.
+static const float DENSITY_PALETTE[][3] = {
+  { 10, 10, 10 },
+  { 92, 106, 114 },
+  { 255, 244, 230 },
+};
+
+template <typename T, int D>
+static void
+density_deposit (const bh::point_vector_t<T, D> &previous,
+                 const bh::point_vector_t<T, D> &current, float alpha,
+                 std::size_t begin, std::size_t end,
+                 const bh::density_frame_t &frame, bh::density_weight_t weight,
+                 float *grid)
+{
+  const double sx = frame.columns / frame.width;
+  const double sy = frame.rows / frame.height;
+
+  for (std::size_t i = begin; i < end; ++i)
+    {
+      double position[2];
+      for (int axis = 0; axis < 2; ++axis)
+        position[axis] = previous[i].position[axis]
+                         + (current[i].position[axis]
+                            - previous[i].position[axis])
+                               * alpha;
+
+      // Pixel centres sit at half-integer coordinates.
+      const double fx = (position[0] - frame.left) * sx - 0.5;
+      const double fy = (position[1] - frame.top) * sy - 0.5;
+      if (!(fx > -1 && fx < frame.columns && fy > -1 && fy < frame.rows))
+        continue;
+
+      const int x = static_cast<int> (std::floor (fx));
+      const int y = static_cast<int> (std::floor (fy));
+      const float tx = static_cast<float> (fx - x);
+      const float ty = static_cast<float> (fy - y);
+      const float w = weight == bh::DENSITY_MASS
+                          ? static_cast<float> (current[i].mass)
+                          : 1.f;
+
+      const float share[2][2] = { { (1 - tx) * (1 - ty), tx * (1 - ty) },
+                                  { (1 - tx) * ty, tx * ty } };
+      for (int dy = 0; dy < 2; ++dy)
+        for (int dx = 0; dx < 2; ++dx)
+          if (x + dx >= 0 && x + dx < frame.columns && y + dy >= 0
+              && y + dy < frame.rows)
+            grid[std::size_t (y + dy) * frame.columns + x + dx]
+                += w * share[dy][dx];
+    }
+}
+
+template <typename T, int D>
+void
+density_accumulate (bh::task_pool_t *pool,
+                    const bh::point_vector_t<T, D> &points,
+                    const bh::density_frame_t &frame,
+                    bh::density_weight_t weight, std::vector<float> *grid)
+{
+  bh::density_accumulate<T, D> (pool, points, points, 0.f, frame, weight,
+                                grid);
+}
+
+template <typename T, int D>
+void
+density_accumulate (bh::task_pool_t *pool,
+                    const bh::point_vector_t<T, D> &previous,
+                    const bh::point_vector_t<T, D> &current, float alpha,
+                    const bh::density_frame_t &frame,
+                    bh::density_weight_t weight, std::vector<float> *grid)
+{
+  const std::size_t cells = std::size_t (frame.columns) * frame.rows;
+  grid->assign (cells, 0.f);
+  if (cells == 0 || current.empty ())
+    return;
+
+  const std::size_t fit
+      = std::max<std::size_t> (1, bh::DENSITY_SCRATCH_BYTES
+                                      / (cells * sizeof (float)));
+  const std::size_t parts = std::min<std::size_t> (
+      { std::size_t (bh::task_pool_size (pool)), fit, current.size () });
+
+  // The first part deposits straight into `grid`.
+  std::vector<std::vector<float> > scratch (parts - 1);
+  bh::task_pool_parallel_for (
+      pool, parts, 1, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t p = begin; p < end; ++p)
+          {
+            float *out = grid->data ();
+            if (p > 0)
+              {
+                scratch[p - 1].assign (cells, 0.f);
+                out = scratch[p - 1].data ();
+              }
+
+            bh::density_deposit (previous, current, alpha,
+                                 p * current.size () / parts,
+                                 (p + 1) * current.size () / parts, frame,
+                                 weight, out);
+          }
+      });
+
+  if (scratch.empty ())
+    return;
+
+  bh::task_pool_parallel_for (
+      pool, cells, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (const auto &part : scratch)
+          for (std::size_t i = begin; i < end; ++i)
+            (*grid)[i] += part[i];
+      });
+}
+
+void
+density_tone_map (bh::task_pool_t *pool, const std::vector<float> &grid,
+                  bh::density_tone_t tone, float softness,
+                  std::vector<std::uint8_t> *rgba)
+{
+  const std::size_t cells = grid.size ();
+  const std::size_t grain = 16384;
+  const std::size_t chunks = (cells + grain - 1) / grain;
+
+  // Largest value, sum and number of non-empty pixels per chunk.
+  std::vector<float> chunk_max (chunks, 0.f);
+  std::vector<double> chunk_sum (chunks, 0.0);
+  std::vector<std::size_t> chunk_used (chunks, 0);
+  bh::task_pool_parallel_for (
+      pool, cells, grain, [&] (std::size_t begin, std::size_t end) {
+        const std::size_t c = begin / grain;
+        for (std::size_t i = begin; i < end; ++i)
+          if (grid[i] > 0)
+            {
+              chunk_max[c] = std::max (chunk_max[c], grid[i]);
+              chunk_sum[c] += grid[i];
+              chunk_used[c]++;
+            }
+      });
+
+  float max = 0.f;
+  double sum = 0.0;
+  std::size_t used = 0;
+  for (std::size_t c = 0; c < chunks; ++c)
+    {
+      max = std::max (max, chunk_max[c]);
+      sum += chunk_sum[c];
+      used += chunk_used[c];
+    }
+
+  if (!(softness > 0))
+    softness = used > 0 ? static_cast<float> (sum / used) : 1.f;
+
+  const auto curve = [tone, softness] (float d) {
+    return tone == bh::DENSITY_ASINH ? std::asinh (d / softness)
+                                     : std::log1p (d / softness);
+  };
+  const float top = max > 0 ? curve (max) : 1.f;
+
+  constexpr int STOPS
+      = sizeof (bh::DENSITY_PALETTE) / sizeof (*bh::DENSITY_PALETTE);
+
+  rgba->resize (cells * 4);
+  bh::task_pool_parallel_for (
+      pool, cells, grain, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            const float t = std::clamp (curve (grid[i]) / top, 0.f, 1.f)
+                            * (STOPS - 1);
+            const int s = std::min (static_cast<int> (t), STOPS - 2);
+            const float f = t - s;
+            const float *lo = bh::DENSITY_PALETTE[s];
+            const float *hi = bh::DENSITY_PALETTE[s + 1];
+
+            std::uint8_t *pixel = rgba->data () + i * 4;
+            for (int k = 0; k < 3; ++k)
+              pixel[k]
+                  = static_cast<std::uint8_t> (lo[k] + (hi[k] - lo[k]) * f);
+            pixel[3] = 255;
+          }
+      });
+}
+
+BH_DENSITY_INSTANTIATE (, float, 2)
+BH_DENSITY_INSTANTIATE (, float, 3)
+BH_DENSITY_INSTANTIATE (, double, 2)
+BH_DENSITY_INSTANTIATE (, double, 3)
+
+}
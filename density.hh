@@ -0,0 +1,82 @@
+#ifndef BH_DENSITY_HH
+#define BH_DENSITY_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "task_pool.hh"
+#include "tree.hh"
+
+namespace bh
+{
+
+// Pixel grid over [left, left + width) x [top, top + height) of the x/y
+// plane, row 0 at `top`. 3D bodies are projected along z.
+struct density_frame_t
+{
+  double left;
+  double top;
+  double width;
+  double height;
+  int columns;
+  int rows;
+};
+
+enum density_weight_t
+{
+  DENSITY_MASS,
+  DENSITY_COUNT,
+};
+
+enum density_tone_t
+{
+  DENSITY_LOG,
+  DENSITY_ASINH,
+};
+
+// Deposits the mass or count of every body on `grid`, `columns * rows`
+// values row after row, with cloud-in-cell weights. Tasks sum into private
+// grids that are then added up, so no pixel is written by two threads.
+template <typename T, int D>
+void density_accumulate (bh::task_pool_t *pool,
+                         const bh::point_vector_t<T, D> &points,
+                         const bh::density_frame_t &frame,
+                         bh::density_weight_t weight,
+                         std::vector<float> *grid);
+
+// As above, with every body deposited at `previous + (current - previous) *
+// alpha`, where the point renderer draws it between two steps.
+template <typename T, int D>
+void density_accumulate (bh::task_pool_t *pool,
+                         const bh::point_vector_t<T, D> &previous,
+                         const bh::point_vector_t<T, D> &current, float alpha,
+                         const bh::density_frame_t &frame,
+                         bh::density_weight_t weight,
+                         std::vector<float> *grid);
+
+// Tone maps `grid` to RGBA pixels: f(d / softness) / f(max / softness) with
+// f = log1p or asinh, through a dark-to-white palette. `softness` is where
+// the curve turns from linear to logarithmic; 0 takes the mean density of
+// the pixels that have any.
+void density_tone_map (bh::task_pool_t *pool, const std::vector<float> &grid,
+                       bh::density_tone_t tone, float softness,
+                       std::vector<std::uint8_t> *rgba);
+
+#define BH_DENSITY_INSTANTIATE(PREFIX, T, D)                                  \
+  PREFIX template void density_accumulate<T, D> (                             \
+      bh::task_pool_t *, const bh::point_vector_t<T, D> &,                    \
+      const bh::density_frame_t &, bh::density_weight_t,                      \
+      std::vector<float> *);                                                 \
+  PREFIX template void density_accumulate<T, D> (                             \
+      bh::task_pool_t *, const bh::point_vector_t<T, D> &,                    \
+      const bh::point_vector_t<T, D> &, float, const bh::density_frame_t &,   \
+      bh::density_weight_t, std::vector<float> *);
+
+BH_DENSITY_INSTANTIATE (extern, float, 2)
+BH_DENSITY_INSTANTIATE (extern, float, 3)
+BH_DENSITY_INSTANTIATE (extern, double, 2)
+BH_DENSITY_INSTANTIATE (extern, double, 3)
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef BH_FORCE_HH
+#define BH_FORCE_HH
+
+#include <cmath>
+
+#include "tree.hh"
+
+namespace bh
+{
+
+// Softening kernels. Both use `softening` as the Plummer-equivalent length.
+enum kernel_t
+{
+  // a = G M r / (r^2 + eps^2)^(3/2).
+  KERNEL_PLUMMER,
+  // Cubic spline of radius h = 2.8 eps: exactly Newtonian beyond h.
+  KERNEL_SPLINE,
+};
+
+// Physical and numerical parameters of a run, as set by the user.
+struct params_t
+{
+  float theta{ 0.5f };
+  float gravity{ 1.0f };
+  float time_step{ 1.0f };
+  float softening{ 1.0f };
+  bh::kernel_t kernel{ bh::KERNEL_PLUMMER };
+};
+
+// Force-law policies. A policy carries whatever the walk needs in the form
+// it needs it, so nothing in the recursion reads global state. Members that
+// a policy fixes are `static constexpr` and fold into the arithmetic; the
+// rest are copied once per step.
+
+// Any parameters, with the kernel chosen at compile time.
+template <typename T, bh::kernel_t K> struct policy_general_t
+{
+  static constexpr bh::kernel_t kernel = K;
+
+  T gravity;
+  T softening2;
+  T spline_h;
+  T spline_h_inv;
+  T spline_h3_inv;
+  T theta2;
+  T time_step;
+};
+
+// G = 1 and a unit Plummer softening, the defaults of every run so far.
+template <typename T> struct policy_unit_t
+{
+  static constexpr bh::kernel_t kernel = bh::KERNEL_PLUMMER;
+  static constexpr T gravity = 1;
+  static constexpr T softening2 = 1;
+
+  T theta2;
+  T time_step;
+};
+
+template <typename T, bh::kernel_t K>
+static inline void
+policy_init (bh::policy_general_t<T, K> *policy, const bh::params_t &params)
+{
+  const T softening = params.softening;
+
+  policy->gravity = params.gravity;
+  policy->softening2 = softening * softening;
+  policy->spline_h = T (2.8) * softening;
+  policy->spline_h_inv = policy->spline_h > 0 ? 1 / policy->spline_h : 0;
+  policy->spline_h3_inv = policy->spline_h_inv * policy->spline_h_inv
+                          * policy->spline_h_inv;
+  policy->theta2 = T (params.theta) * T (params.theta);
+  policy->time_step = params.time_step;
+}
+
+template <typename T>
+static inline bool
+policy_accepts (const bh::policy_unit_t<T> *, const bh::params_t &params)
+{
+  return params.gravity == 1 && params.softening == 1
+         && params.kernel == bh::KERNEL_PLUMMER;
+}
+
+template <typename T>
+static inline void
+policy_init (bh::policy_unit_t<T> *policy, const bh::params_t &params)
+{
+  policy->theta2 = T (params.theta) * T (params.theta);
+  policy->time_step = params.time_step;
+}
+
+// Acceleration per unit of `G M` and of separation vector at squared
+// separation `r2`, i.e. 1 / r^3 softened by the policy's kernel.
+template <typename T, typename P>
+static inline T
+kernel_factor (const P &policy, T r2)
+{
+  if constexpr (P::kernel == bh::KERNEL_PLUMMER)
+    {
+      const T inv = 1 / std::sqrt (r2 + policy.softening2);
+      return inv * inv * inv;
+    }
+  else
+    {
+      const T r = std::sqrt (r2);
+      if (r >= policy.spline_h)
+        return 1 / (r2 * r);
+
+      const T u = r * policy.spline_h_inv;
+      if (u < T (0.5))
+        return policy.spline_h3_inv
+               * (T (10.666666666667) + u * u * (T (32.0) * u - T (38.4)));
+
+      return policy.spline_h3_inv
+             * (T (21.333333333333) - T (48.0) * u + T (38.4) * u * u
+                - T (10.666666666667) * u * u * u
+                - T (0.066666666667) / (u * u * u));
+    }
+}
+
+// Potential per unit of `G M` at squared separation `r2`, i.e. -1 / r
+// softened by the policy's kernel consistently with `kernel_factor`.
+template <typename T, typename P>
+static inline T
+kernel_potential (const P &policy, T r2)
+{
+  if constexpr (P::kernel == bh::KERNEL_PLUMMER)
+    return -1 / std::sqrt (r2 + policy.softening2);
+  else
+    {
+      const T r = std::sqrt (r2);
+      if (r >= policy.spline_h)
+        return -1 / r;
+
+      const T u = r * policy.spline_h_inv;
+      const T u2 = u * u;
+      if (u < T (0.5))
+        return policy.spline_h_inv
+               * (T (-2.8)
+                  + u2 * (T (5.333333333333) + u2 * (T (6.4) * u - T (9.6))));
+
+      const T tail = T (9.6) - T (2.133333333333) * u;
+      return policy.spline_h_inv
+             * (T (-3.2) + T (0.066666666667) / u
+                + u2 * (T (10.666666666667) + u * (T (-16.0) + u * tail)));
+    }
+}
+
+template <bool POTENTIAL, typename T, int D, typename P>
+static inline unsigned
+tree_node_walk (const bh::tree_node_t<T, D> &node, bh::point_t<T, D> *point,
+                const P &policy, T *potential)
+{
+  if (node.total_mass == 0 || point->position == node.center_of_mass)
+    return 0;
+
+  const bh::vec_t<T, D> direction = node.center_of_mass - point->position;
+  const T r2 = bh::dot (direction, direction);
+
+  if (bh::tree_node_is_leaf (node) || r2 > node.open2)
+    {
+      const T gm = policy.gravity * node.total_mass;
+      const T factor = gm * bh::kernel_factor (policy, r2);
+      point->velocity += direction * (factor * policy.time_step);
+      if constexpr (POTENTIAL)
+        *potential += gm * bh::kernel_potential (policy, r2);
+      return 1;
+    }
+
+  unsigned interactions = 0;
+  for (auto child : node.children)
+    interactions
+        += bh::tree_node_walk<POTENTIAL> (*child, point, policy, potential);
+
+  return interactions;
+}
+
+// Kicks `point` with the force of everything below `node` and returns the
+// number of interactions evaluated. A node is accepted once the point lies
+// beyond its precomputed `open2`, so opening a node costs one dot product
+// and one comparison; the square root is only paid inside the kernel.
+template <typename T, int D, typename P>
+static inline unsigned
+tree_node_compute_force (const bh::tree_node_t<T, D> &node,
+                         bh::point_t<T, D> *point, const P &policy)
+{
+  return bh::tree_node_walk<false> (node, point, policy,
+                                    static_cast<T *> (NULL));
+}
+
+// As above, and adds the potential of everything below `node` at the point,
+// per unit of its mass, to `*potential`. The same accepted nodes give both,
+// so the potential costs one more kernel evaluation per interaction.
+template <typename T, int D, typename P>
+static inline unsigned
+tree_node_compute_force (const bh::tree_node_t<T, D> &node,
+                         bh::point_t<T, D> *point, const P &policy,
+                         T *potential)
+{
+  return bh::tree_node_walk<true> (node, point, policy, potential);
+}
+
+}
+
+#endif
@@ -0,0 +1,243 @@
+#include "frames.hh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace bh
+{
+
+template <typename T, int D> struct frame_writer_t
+{
+  std::thread thread{};
+  std::mutex mutex{};
+  std::condition_variable cv{};
+  bool running{ true };
+
+  // Slot indices owned by the caller (`idle`) or waiting for the writer
+  // thread (`queued`), oldest first.
+  std::vector<bh::point_vector_t<T, D> > slots{};
+  std::vector<int> idle{};
+  std::deque<int> queued{};
+  bool failed{ false };
+
+  // Only touched by the writer thread from here on.
+  bh::frame_options_t options{};
+  bh::task_pool_t *pool{ NULL };
+  std::string pattern{};
+  FILE *pipe{ NULL };
+  std::uint64_t frames{ 0 };
+
+  std::vector<float> grid{};
+  std::vector<std::uint8_t> rgba{};
+  std::vector<std::uint8_t> rgb{};
+};
+
+// Accepts exactly one integer conversion, `%d` with optional flags and width,
+// besides any number of `%%`.
+static bool
+frame_pattern_valid (const char *pattern)
+{
+  int conversions = 0;
+  for (const char *c = pattern; *c != '\0'; ++c)
+    {
+      if (*c != '%')
+        continue;
+      if (*++c == '%')
+        continue;
+
+      while (*c == '0' || *c == '-' || *c == ' ' || *c == '+')
+        ++c;
+      while (*c >= '0' && *c <= '9')
+        ++c;
+
+      if (*c != 'd' && *c != 'i' && *c != 'u')
+        return false;
+      ++conversions;
+    }
+
+  return conversions == 1;
+}
+
+template <typename T, int D>
+static bool
+frame_write (bh::frame_writer_t<T, D> *writer,
+             const bh::point_vector_t<T, D> &points)
+{
+  const bh::frame_options_t &options = writer->options;
+  const bh::density_frame_t frame{
+    -options.width * options.scale / 2, -options.height * options.scale / 2,
+    options.width * options.scale,      options.height * options.scale,
+    options.width,                      options.height
+  };
+
+  bh::density_accumulate<T, D> (writer->pool, points, frame, bh::DENSITY_MASS,
+                                &writer->grid);
+  bh::density_tone_map (writer->pool, writer->grid, options.tone,
+                        options.softness, &writer->rgba);
+
+  const std::size_t pixels = std::size_t (options.width) * options.height;
+  writer->rgb.resize (pixels * 3);
+  for (std::size_t i = 0; i < pixels; ++i)
+    std::memcpy (&writer->rgb[i * 3], &writer->rgba[i * 4], 3);
+
+  const std::uint64_t number = writer->frames++;
+  if (writer->pipe != NULL)
+    return std::fwrite (writer->rgb.data (), 1, writer->rgb.size (),
+                        writer->pipe)
+           == writer->rgb.size ();
+
+  char path[4096];
+  std::snprintf (path, sizeof (path), writer->pattern.c_str (),
+                 static_cast<int> (number));
+
+  FILE *file = std::fopen (path, "wb");
+  if (file == NULL)
+    {
+      fprintf (stderr, "frames: cannot create %s\n", path);
+      return false;
+    }
+
+  fprintf (file, "P6\n%d %d\n255\n", options.width, options.height);
+  bool ok = std::fwrite (writer->rgb.data (), 1, writer->rgb.size (), file)
+            == writer->rgb.size ();
+  ok = std::fclose (file) == 0 && ok;
+  if (!ok)
+    fprintf (stderr, "frames: failed to write %s\n", path);
+
+  return ok;
+}
+
+template <typename T, int D>
+static void
+frame_writer_main (bh::frame_writer_t<T, D> *writer)
+{
+  std::unique_lock<std::mutex> lock (writer->mutex);
+
+  for (;;)
+    {
+      writer->cv.wait (lock, [writer] () {
+        return !writer->queued.empty () || !writer->running;
+      });
+
+      if (writer->queued.empty ())
+        return;
+
+      const int slot = writer->queued.front ();
+      writer->queued.pop_front ();
+      const bool failed = writer->failed;
+      lock.unlock ();
+
+      const bool ok
+          = failed || bh::frame_write (writer, writer->slots[slot]);
+      if (!ok)
+        fprintf (stderr, "frames: write failed, export stopped\n");
+
+      lock.lock ();
+      writer->failed = !ok || writer->failed;
+      writer->idle.push_back (slot);
+      writer->cv.notify_all ();
+    }
+}
+
+template <typename T, int D>
+bh::frame_writer_t<T, D> *
+frame_writer_init (const char *target, const bh::frame_options_t &options)
+{
+  FILE *pipe = NULL;
+  if (target[0] == '|')
+    {
+      // A command that exits early must fail the write, not kill the run.
+      std::signal (SIGPIPE, SIG_IGN);
+
+      pipe = popen (target + 1, "w");
+      if (pipe == NULL)
+        {
+          fprintf (stderr, "frames: cannot start %s\n", target + 1);
+          return NULL;
+        }
+    }
+  else if (!bh::frame_pattern_valid (target))
+    {
+      fprintf (stderr,
+               "frames: %s needs exactly one %%d for the frame number\n",
+               target);
+      return NULL;
+    }
+
+  auto *writer = new bh::frame_writer_t<T, D>{};
+  writer->options = options;
+  writer->pool = bh::task_pool_init (std::max (options.threads, 1), false);
+  writer->pipe = pipe;
+  if (pipe == NULL)
+    writer->pattern = target;
+
+  writer->slots.resize (std::max (options.queue, 1));
+  for (int slot = writer->slots.size () - 1; slot >= 0; --slot)
+    writer->idle.push_back (slot);
+
+  writer->thread = std::thread (bh::frame_writer_main<T, D>, writer);
+  return writer;
+}
+
+template <typename T, int D>
+bool
+frame_writer_push (bh::frame_writer_t<T, D> *writer,
+                   const bh::simulation_t<T, D> &sim)
+{
+  int slot;
+  {
+    std::unique_lock<std::mutex> lock (writer->mutex);
+    writer->cv.wait (lock, [writer] () {
+      return !writer->idle.empty () || writer->failed;
+    });
+    if (writer->failed)
+      return false;
+
+    slot = writer->idle.back ();
+    writer->idle.pop_back ();
+  }
+
+  bh::points_copy<T, D> (sim.pool, &writer->slots[slot], sim.points);
+
+  {
+    std::lock_guard<std::mutex> lock (writer->mutex);
+    writer->queued.push_back (slot);
+  }
+  writer->cv.notify_all ();
+  return true;
+}
+
+template <typename T, int D>
+void
+frame_writer_free (bh::frame_writer_t<T, D> *writer)
+{
+  if (writer == NULL)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock (writer->mutex);
+    writer->running = false;
+  }
+  writer->cv.notify_all ();
+  writer->thread.join ();
+
+  if (writer->pipe != NULL && pclose (writer->pipe) != 0)
+    fprintf (stderr, "frames: the video command failed\n");
+
+  bh::task_pool_free (writer->pool);
+  delete writer;
+}
+
+BH_FRAMES_INSTANTIATE (, float, 2)
+BH_FRAMES_INSTANTIATE (, float, 3)
+BH_FRAMES_INSTANTIATE (, double, 2)
+BH_FRAMES_INSTANTIATE (, double, 3)
+
+}
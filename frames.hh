@@ -0,0 +1,68 @@
+#ifndef BH_FRAMES_HH
+#define BH_FRAMES_HH
+
+#include "density.hh"
+#include "simulation.hh"
+
+namespace bh
+{
+
+struct frame_options_t
+{
+  int width{ 800 };
+  int height{ 800 };
+
+  // World units per pixel; the frame is centred on the origin.
+  double scale{ 1.5 };
+
+  bh::density_tone_t tone{ bh::DENSITY_ASINH };
+  float softness{ 0 };
+
+  // Threads of the writer's own raster pool. It runs beside the solver's
+  // pool, so it stays small unless asked otherwise.
+  int threads{ 2 };
+
+  // Frames that may wait for the writer. When all are taken,
+  // `frame_writer_push` waits for one rather than drop a frame of the movie.
+  int queue{ 4 };
+};
+
+// Background movie writer. The caller only copies the bodies into a free
+// queue slot; the density map is rasterized on the writer's own pool and
+// written by its thread, either as binary PPM images named by `target`, a
+// printf pattern with one integer conversion such as `frames/%06d.ppm`, or
+// as raw RGB24 video into the standard input of the shell command that
+// follows a leading `|`.
+template <typename T, int D> struct frame_writer_t;
+
+// Returns NULL, after saying why on stderr, if `target` is neither a valid
+// pattern nor a command that could be started.
+template <typename T, int D>
+bh::frame_writer_t<T, D> *
+frame_writer_init (const char *target, const bh::frame_options_t &options);
+
+// Queues the current bodies of `sim` as the next frame. Returns false once
+// writing has failed.
+template <typename T, int D>
+bool frame_writer_push (bh::frame_writer_t<T, D> *writer,
+                        const bh::simulation_t<T, D> &sim);
+
+// Writes the queued frames and closes the pipe, waiting for its command.
+template <typename T, int D>
+void frame_writer_free (bh::frame_writer_t<T, D> *writer);
+
+#define BH_FRAMES_INSTANTIATE(PREFIX, T, D)                                   \
+  PREFIX template bh::frame_writer_t<T, D> *frame_writer_init<T, D> (         \
+      const char *, const bh::frame_options_t &);                             \
+  PREFIX template bool frame_writer_push<T, D> (                              \
+      bh::frame_writer_t<T, D> *, const bh::simulation_t<T, D> &);            \
+  PREFIX template void frame_writer_free<T, D> (bh::frame_writer_t<T, D> *);
+
+BH_FRAMES_INSTANTIATE (extern, float, 2)
+BH_FRAMES_INSTANTIATE (extern, float, 3)
+BH_FRAMES_INSTANTIATE (extern, double, 2)
+BH_FRAMES_INSTANTIATE (extern, double, 3)
+
+}
+
+#endif
@@ -0,0 +1,620 @@
+#include "galaxy.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "random.hh"
+
+namespace bh
+{
+
+template <typename T, int D>
+void
+push_galaxy (bh::task_pool_t *pool, bh::point_vector_t<T, D> &points, int n,
+             std::uint64_t seed, float inital_radius, float speed,
+             float center_x, float center_y, float base_velocity_x,
+             float base_velocity_y, float mass)
+{
+  const std::size_t first = points.size ();
+  points.resize (first + n);
+
+  bh::task_pool_parallel_for (
+      pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            const bh::random_block_t r = bh::random_philox (i, seed);
+
+            const double angle = bh::random_unit (r.v[0]) * 2 * M_PI;
+            const double fraction = std::sqrt (bh::random_unit (r.v[1]));
+            const double radius = fraction * inital_radius;
+
+            // Circular orbits, counter-clockwise, with speed growing
+            // linearly towards the rim.
+            bh::vec_t<T, D> position{}, velocity{};
+            position[0] = T (center_x + std::cos (angle) * radius);
+            position[1] = T (center_y + std::sin (angle) * radius);
+            velocity[0] = T (base_velocity_x
+                             - std::sin (angle) * speed * fraction);
+            velocity[1] = T (base_velocity_y
+                             + std::cos (angle) * speed * fraction);
+
+            if (D == 3)
+              position[D - 1] = T ((bh::random_unit (r.v[2]) - 0.5)
+                                   * inital_radius * 0.1);
+
+            points[first + i]
+                = bh::point_init<T, D> (T (mass), position, velocity);
+          }
+      });
+}
+
+// Radial bins of the Jeans tables, log-spaced.
+static const int GALAXY_BINS = 128;
+
+enum galaxy_component_t
+{
+  GALAXY_DISK,
+  GALAXY_BULGE,
+  GALAXY_HALO,
+};
+
+// Radius enclosing fraction `u` of a Plummer profile of scale `a` truncated
+// at `cutoff` scale radii; a Plummer disk in 2D.
+template <int D>
+static double
+galaxy_plummer_radius (double u, double a, double cutoff)
+{
+  const double c2 = cutoff * cutoff;
+  u *= D == 3 ? c2 * cutoff / std::pow (c2 + 1, 1.5) : c2 / (c2 + 1);
+
+  if (!(u > 0))
+    return 0;
+
+  return D == 3 ? a / std::sqrt (std::pow (u, -2.0 / 3.0) - 1)
+                : a * std::sqrt (u / (1 - u));
+}
+
+// Fraction of an exponential disk's mass within `x` scale lengths.
+static double
+galaxy_disk_enclosed (double x)
+{
+  return 1 - (1 + x) * std::exp (-x);
+}
+
+// Radius enclosing fraction `u` of an exponential disk of scale `h`
+// truncated at `cutoff` scale lengths, by bisection on the enclosed mass.
+static double
+galaxy_disk_radius (double u, double h, double cutoff)
+{
+  const double target = u * bh::galaxy_disk_enclosed (cutoff);
+
+  double lo = 0, hi = cutoff;
+  for (int i = 0; i < 40; ++i)
+    {
+      const double mid = (lo + hi) / 2;
+      (bh::galaxy_disk_enclosed (mid) < target ? lo : hi) = mid;
+    }
+
+  return (lo + hi) / 2 * h;
+}
+
+// Density shape of a Plummer component at radius `r`, up to a constant.
+template <int D>
+static double
+galaxy_plummer_density (double r, double a)
+{
+  const double q = 1 + r * r / (a * a);
+  return D == 3 ? std::pow (q, -2.5) : 1 / (q * q);
+}
+
+// Two standard normal deviates from two uniform words.
+static inline void
+galaxy_gaussian (std::uint32_t a, std::uint32_t b, double *g0, double *g1)
+{
+  const double radius = std::sqrt (-2 * std::log (1 - bh::random_unit (a)));
+  const double angle = 2 * M_PI * bh::random_unit (b);
+  *g0 = radius * std::cos (angle);
+  *g1 = radius * std::sin (angle);
+}
+
+// Mean of the per-chunk `sums` over `counts` in every radial bin, and into
+// `totals`, unless NULL, the count of every bin. Empty bins take the value of
+// the nearest filled bin inside them, or outside them at the very centre.
+static std::vector<double>
+galaxy_bin_means (const std::vector<double> &sums,
+                  const std::vector<std::size_t> &counts,
+                  std::vector<double> *totals)
+{
+  const std::size_t chunks = sums.size () / bh::GALAXY_BINS;
+
+  std::vector<double> means (bh::GALAXY_BINS, 0);
+  std::vector<bool> filled (bh::GALAXY_BINS, false);
+  if (totals != NULL)
+    totals->assign (bh::GALAXY_BINS, 0);
+
+  for (int k = 0; k < bh::GALAXY_BINS; ++k)
+    {
+      double sum = 0;
+      std::size_t count = 0;
+      for (std::size_t c = 0; c < chunks; ++c)
+        {
+          sum += sums[c * bh::GALAXY_BINS + k];
+          count += counts[c * bh::GALAXY_BINS + k];
+        }
+
+      if (totals != NULL)
+        (*totals)[k] = count;
+      if (count > 0)
+        means[k] = std::max (sum / count, 0.0), filled[k] = true;
+    }
+
+  for (int k = 1; k < bh::GALAXY_BINS; ++k)
+    if (!filled[k] && filled[k - 1])
+      means[k] = means[k - 1], filled[k] = true;
+  for (int k = bh::GALAXY_BINS - 2; k >= 0; --k)
+    if (!filled[k] && filled[k + 1])
+      means[k] = means[k + 1], filled[k] = true;
+
+  return means;
+}
+
+// Least-squares line through `values` against the bin index, over the bins
+// within `width` of `k` and weighted by `weights`. Returns its value at `k`
+// and its slope per bin in `slope`; a single bin has no slope.
+static double
+galaxy_bin_fit (const std::vector<double> &values,
+                const std::vector<double> &weights, int k, int width,
+                double *slope)
+{
+  double w = 0, wx = 0, wy = 0, wxx = 0, wxy = 0;
+  for (int j = std::max (k - width, 0);
+       j <= std::min (k + width, bh::GALAXY_BINS - 1); ++j)
+    {
+      const double x = j - k;
+      w += weights[j];
+      wx += weights[j] * x;
+      wy += weights[j] * values[j];
+      wxx += weights[j] * x * x;
+      wxy += weights[j] * x * values[j];
+    }
+
+  const double det = w * wxx - wx * wx;
+  if (!(w > 0) || !(det > 0))
+    return *slope = 0, values[k];
+
+  *slope = (w * wxy - wx * wy) / det;
+  return (wy - *slope * wx) / w;
+}
+
+template <typename T, int D>
+static double
+galaxy_radius (const bh::vec_t<T, D> &position)
+{
+  double r2 = 0;
+  for (int axis = 0; axis < D; ++axis)
+    r2 += double (position[axis]) * position[axis];
+
+  return std::sqrt (r2);
+}
+
+template <typename T, int D>
+void
+push_galaxy_model (bh::task_pool_t *pool, bh::point_vector_t<T, D> &points,
+                   const bh::scenario_galaxy_t &galaxy,
+                   const bh::params_t &params)
+{
+  const bh::galaxy_model_t &model = galaxy.model;
+  const std::size_t n = std::max (galaxy.bodies, 1);
+
+  const double fractions = model.disk_fraction + model.bulge_fraction
+                           + model.halo_fraction;
+  const std::size_t disk_end = std::llround (n * model.disk_fraction
+                                             / fractions);
+  const std::size_t bulge_end
+      = disk_end + std::llround (n * model.bulge_fraction / fractions);
+
+  const auto component = [&] (std::size_t i) {
+    return i < disk_end    ? bh::GALAXY_DISK
+           : i < bulge_end ? bh::GALAXY_BULGE
+                           : bh::GALAXY_HALO;
+  };
+
+  const double body_mass = double (model.mass) / n;
+  const double cutoff = model.cutoff;
+
+  bh::simulation_t<T, D> local{};
+  local.pool = pool;
+  local.params = params;
+  local.points.resize (n);
+
+  bh::task_pool_parallel_for (
+      pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            const bh::random_block_t r = bh::random_philox (i, galaxy.seed);
+            const double phi = 2 * M_PI * bh::random_unit (r.v[1]);
+
+            bh::vec_t<T, D> position{};
+            if (component (i) == bh::GALAXY_DISK)
+              {
+                const double radius = bh::galaxy_disk_radius (
+                    bh::random_unit (r.v[0]), model.disk_scale, cutoff);
+                position[0] = T (radius * std::cos (phi));
+                position[1] = T (radius * std::sin (phi));
+
+                if (D == 3)
+                  {
+                    const double u = std::clamp (bh::random_unit (r.v[2]),
+                                                 1e-9, 1 - 1e-9);
+                    position[D - 1] = T (std::clamp (
+                        model.disk_height * std::atanh (2 * u - 1),
+                        -cutoff * model.disk_height,
+                        cutoff * model.disk_height));
+                  }
+              }
+            else
+              {
+                const double scale = component (i) == bh::GALAXY_BULGE
+                                         ? model.bulge_scale
+                                         : model.halo_scale;
+                const double radius = bh::galaxy_plummer_radius<D> (
+                    bh::random_unit (r.v[0]), scale, cutoff);
+
+                const double cos_theta
+                    = D == 3 ? 2 * bh::random_unit (r.v[2]) - 1 : 0;
+                const double sin_theta
+                    = std::sqrt (1 - cos_theta * cos_theta);
+                position[0] = T (radius * sin_theta * std::cos (phi));
+                position[1] = T (radius * sin_theta * std::sin (phi));
+                if (D == 3)
+                  position[D - 1] = T (radius * cos_theta);
+              }
+
+            local.points[i] = bh::point_init<T, D> (T (body_mass), position);
+          }
+      });
+
+  double extent = 0;
+  for (const auto &point : local.points)
+    for (int axis = 0; axis < D; ++axis)
+      extent = std::max (extent, std::fabs (double (point.position[axis])));
+
+  extent = extent * 1.001 + 1;
+  for (int axis = 0; axis < D; ++axis)
+    local.boundary.corner[axis] = T (-extent);
+  local.boundary.width = T (2 * extent);
+
+  std::vector<bh::vec_t<T, D> > accelerations{};
+  bh::simulation_accelerations (&local, &accelerations);
+  bh::simulation_finish (&local);
+
+  // Mean inward acceleration per radial bin, accumulated per chunk so that
+  // the sums do not depend on the schedule; for the disk also the mean
+  // in-plane one of its own bodies, binned by cylindrical radius.
+  const std::size_t grain = 16384;
+  const std::size_t chunks = (n + grain - 1) / grain;
+  const double r_max = extent;
+  const double r_min = r_max * 1e-4;
+  const double log_span = std::log (r_max / r_min);
+
+  const auto bin_of = [&] (double radius) {
+    if (!(radius > r_min))
+      return 0;
+    return std::min (
+        int (std::log (radius / r_min) / log_span * bh::GALAXY_BINS),
+        bh::GALAXY_BINS - 1);
+  };
+  const auto bin_radius = [&] (int k) {
+    return r_min * std::exp ((k + 0.5) / bh::GALAXY_BINS * log_span);
+  };
+
+  std::vector<double> sums (chunks * bh::GALAXY_BINS, 0);
+  std::vector<std::size_t> counts (chunks * bh::GALAXY_BINS, 0);
+  std::vector<double> disk_sums (chunks * bh::GALAXY_BINS, 0);
+  std::vector<std::size_t> disk_counts (chunks * bh::GALAXY_BINS, 0);
+
+  bh::task_pool_parallel_for (
+      pool, n, grain, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            const bh::vec_t<T, D> &position = local.points[i].position;
+            const double radius = bh::galaxy_radius (position);
+            if (!(radius > 0))
+              continue;
+
+            double inward = 0;
+            for (int axis = 0; axis < D; ++axis)
+              inward -= double (accelerations[i][axis]) * position[axis];
+
+            const std::size_t slot
+                = i / grain * bh::GALAXY_BINS + bin_of (radius);
+            sums[slot] += inward / radius;
+            counts[slot] += 1;
+
+            const double x = position[0], y = position[1];
+            const double planar = std::sqrt (x * x + y * y);
+            if (component (i) != bh::GALAXY_DISK || !(planar > 0))
+              continue;
+
+            const std::size_t disk_slot
+                = i / grain * bh::GALAXY_BINS + bin_of (planar);
+            disk_sums[disk_slot]
+                -= (accelerations[i][0] * x + accelerations[i][1] * y)
+                   / planar;
+            disk_counts[disk_slot] += 1;
+          }
+      });
+
+  std::vector<double> disk_weights{};
+  const std::vector<double> field
+      = bh::galaxy_bin_means (sums, counts, NULL);
+  const std::vector<double> disk_field
+      = bh::galaxy_bin_means (disk_sums, disk_counts, &disk_weights);
+
+  // Isotropic Jeans equation, d (rho sigma^2) / dr = -rho g, integrated
+  // inwards from sigma = 0 at the outermost bin.
+  std::vector<double> sigma2[2];
+  const double scales[2] = { model.bulge_scale, model.halo_scale };
+  for (int c = 0; c < 2; ++c)
+    {
+      sigma2[c].assign (bh::GALAXY_BINS, 0);
+
+      double pressure = 0;
+      for (int k = bh::GALAXY_BINS - 1; k >= 0; --k)
+        {
+          const double lo = r_min * std::exp (double (k) / bh::GALAXY_BINS
+                                              * log_span);
+          const double hi = r_min * std::exp (double (k + 1)
+                                              / bh::GALAXY_BINS * log_span);
+          const double density
+              = bh::galaxy_plummer_density<D> (bin_radius (k), scales[c]);
+
+          pressure += density * field[k] * (hi - lo);
+          sigma2[c][k] = density > 0 ? pressure / density : 0;
+        }
+    }
+
+  const double disk_mass = body_mass * disk_end;
+  const double disk_scale = model.disk_scale;
+  const auto disk_surface = [&] (double radius) {
+    return disk_mass
+           / (2 * M_PI * disk_scale * disk_scale
+              * bh::galaxy_disk_enclosed (cutoff))
+           * std::exp (-radius / disk_scale);
+  };
+
+  // Disk dispersions from Toomre's Q = sigma_R kappa / (3.36 G Sigma), with
+  // kappa^2 = (3 g + dg / d ln R) / R of the in-plane field g, and sigma_phi
+  // from the epicyclic ratio sigma_phi / sigma_R = kappa / (2 Omega). The
+  // field and its slope come from a line fitted over nearby bins, as the
+  // bins near the centre hold few bodies.
+  const int width = 4;
+  const double per_log_radius = bh::GALAXY_BINS / log_span;
+
+  std::vector<double> sigma_r2 (bh::GALAXY_BINS, 0);
+  std::vector<double> sigma_phi2 (bh::GALAXY_BINS, 0);
+  std::vector<double> log_sigma_r2 (bh::GALAXY_BINS, 0);
+  std::vector<double> sigma_weights (bh::GALAXY_BINS, 0);
+  for (int k = 0; k < bh::GALAXY_BINS; ++k)
+    {
+      double slope;
+      const double g = bh::galaxy_bin_fit (disk_field, disk_weights, k,
+                                           width, &slope);
+      const double radius = bin_radius (k);
+
+      const double omega2 = g / radius;
+      const double kappa2 = std::clamp (
+          (3 * g + slope * per_log_radius) / radius, omega2, omega2 * 4);
+      if (!(kappa2 > 0))
+        continue;
+
+      const double sigma_r = model.disk_toomre * 3.36 * params.gravity
+                             * disk_surface (radius) / std::sqrt (kappa2);
+      if (!(sigma_r > 0))
+        continue;
+
+      sigma_r2[k] = sigma_r * sigma_r;
+      sigma_phi2[k] = sigma_r2[k] * kappa2 / (4 * omega2);
+      log_sigma_r2[k] = std::log (sigma_r2[k]);
+      sigma_weights[k] = disk_weights[k];
+    }
+
+  // Asymmetric drift, v_c^2 - v_phi^2 = sigma_phi^2 - sigma_R^2 (1 + d ln
+  // (Sigma sigma_R^2) / d ln R): the share of the circular velocity that the
+  // dispersion supports instead of the mean rotation.
+  std::vector<double> disk_drift (bh::GALAXY_BINS, 0);
+  for (int k = 0; k < bh::GALAXY_BINS; ++k)
+    {
+      double slope;
+      bh::galaxy_bin_fit (log_sigma_r2, sigma_weights, k, width, &slope);
+
+      const double gradient
+          = -bin_radius (k) / disk_scale + slope * per_log_radius;
+      disk_drift[k] = sigma_phi2[k] - sigma_r2[k] * (1 + gradient);
+    }
+
+  bh::task_pool_parallel_for (
+      pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            bh::point_t<T, D> &point = local.points[i];
+            const bh::random_block_t r
+                = bh::random_philox (i, galaxy.seed, 1);
+
+            double g[4];
+            bh::galaxy_gaussian (r.v[0], r.v[1], &g[0], &g[1]);
+            bh::galaxy_gaussian (r.v[2], r.v[3], &g[2], &g[3]);
+
+            if (component (i) == bh::GALAXY_DISK)
+              {
+                const double x = point.position[0], y = point.position[1];
+                const double radius = std::sqrt (x * x + y * y);
+                if (!(radius > 0))
+                  continue;
+
+                const double inward
+                    = -(accelerations[i][0] * x + accelerations[i][1] * y)
+                      / radius;
+                const int k = bin_of (radius);
+                const double mean = std::sqrt (
+                    std::max (radius * inward - disk_drift[k], 0.0));
+
+                const double radial = g[1] * std::sqrt (sigma_r2[k]);
+                const double tangential
+                    = mean + g[2] * std::sqrt (sigma_phi2[k]);
+                point.velocity[0] = T ((radial * x - tangential * y) / radius);
+                point.velocity[1] = T ((radial * y + tangential * x) / radius);
+
+                // Isothermal sheet: sigma_z^2 = pi G Sigma(R) z0.
+                if (D == 3)
+                  point.velocity[D - 1]
+                      = T (g[0]
+                           * std::sqrt (M_PI * params.gravity
+                                        * disk_surface (radius)
+                                        * model.disk_height));
+              }
+            else
+              {
+                const int c = component (i) == bh::GALAXY_BULGE ? 0 : 1;
+                const double sigma = std::sqrt (
+                    sigma2[c][bin_of (bh::galaxy_radius (point.position))]);
+                for (int axis = 0; axis < D; ++axis)
+                  point.velocity[axis] = T (g[axis] * sigma);
+              }
+          }
+      });
+
+  // Sampling noise leaves the galaxy with some net momentum and an offset
+  // centre; both are removed before it is placed.
+  double centre[D] = {}, drift[D] = {}, total = 0;
+  for (const auto &point : local.points)
+    {
+      total += point.mass;
+      for (int axis = 0; axis < D; ++axis)
+        {
+          centre[axis] += double (point.mass) * point.position[axis];
+          drift[axis] += double (point.mass) * point.velocity[axis];
+        }
+    }
+
+  const double cos_i = std::cos (galaxy.inclination);
+  const double sin_i = std::sin (galaxy.inclination);
+
+  const std::size_t first = points.size ();
+  points.resize (first + n);
+
+  bh::task_pool_parallel_for (
+      pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            double position[3] = {}, velocity[3] = {};
+            for (int axis = 0; axis < D; ++axis)
+              {
+                position[axis]
+                    = local.points[i].position[axis] - centre[axis] / total;
+                velocity[axis]
+                    = local.points[i].velocity[axis] - drift[axis] / total;
+              }
+
+            if (D == 3)
+              for (double *v : { position, velocity })
+                {
+                  const double y = v[1], z = v[2];
+                  v[1] = y * cos_i - z * sin_i;
+                  v[2] = y * sin_i + z * cos_i;
+                }
+
+            bh::point_t<T, D> &point = points[first + i];
+            point.mass = local.points[i].mass;
+            for (int axis = 0; axis < D; ++axis)
+              {
+                point.position[axis]
+                    = T (position[axis] + galaxy.position[axis]);
+                point.velocity[axis]
+                    = T (velocity[axis] + galaxy.velocity[axis]);
+              }
+          }
+      });
+}
+
+template <typename T, int D>
+void
+push_scenario (bh::task_pool_t *pool, bh::point_vector_t<T, D> &points,
+               const bh::scenario_t &scenario, const bh::params_t &params)
+{
+  for (const auto &galaxy : scenario)
+    bh::push_galaxy_model<T, D> (pool, points, galaxy, params);
+}
+
+bool
+scenario_preset (const char *name, int bodies, std::uint64_t seed,
+                 const bh::params_t &params, bh::scenario_t *scenario)
+{
+  // Unit-mass bodies, as in the original disk.
+  bh::scenario_galaxy_t galaxy{};
+  galaxy.bodies = bodies;
+  galaxy.seed = seed;
+  galaxy.model.mass = bodies;
+
+  bh::galaxy_model_t &model = galaxy.model;
+  scenario->clear ();
+
+  if (std::strcmp (name, "disk") == 0)
+    return scenario->push_back (galaxy), true;
+
+  if (std::strcmp (name, "plummer") == 0)
+    {
+      model.disk_fraction = 0;
+      model.bulge_fraction = 1;
+      model.bulge_scale = 200;
+      return scenario->push_back (galaxy), true;
+    }
+
+  model.disk_fraction = 0.3f;
+  model.disk_scale = 120;
+  model.disk_height = 12;
+  model.bulge_fraction = 0.1f;
+  model.bulge_scale = 30;
+  model.halo_fraction = 0.6f;
+  model.halo_scale = 600;
+
+  if (std::strcmp (name, "milky-way") == 0)
+    return scenario->push_back (galaxy), true;
+
+  if (std::strcmp (name, "collision") != 0)
+    return false;
+
+  // Two halves on a parabolic orbit, starting well outside each other's
+  // halo, with an impact parameter of a fifth of their separation.
+  galaxy.bodies = bodies / 2;
+  model.mass = galaxy.bodies;
+
+  const double dx = 3000, dy = 600;
+  const double speed
+      = std::sqrt (2 * params.gravity * bodies / std::hypot (dx, dy)) / 2;
+
+  bh::scenario_galaxy_t other = galaxy;
+  other.bodies = bodies - galaxy.bodies;
+  other.model.mass = other.bodies;
+  other.seed = seed + 1;
+  other.inclination = float (M_PI / 3);
+
+  galaxy.position[0] = -dx / 2;
+  galaxy.position[1] = -dy / 2;
+  galaxy.velocity[0] = speed;
+  other.position[0] = dx / 2;
+  other.position[1] = dy / 2;
+  other.velocity[0] = -speed;
+
+  scenario->push_back (galaxy);
+  scenario->push_back (other);
+  return true;
+}
+
+BH_GALAXY_INSTANTIATE (, float, 2)
+BH_GALAXY_INSTANTIATE (, float, 3)
+BH_GALAXY_INSTANTIATE (, double, 2)
+BH_GALAXY_INSTANTIATE (, double, 3)
+
+}
@@ -0,0 +1,108 @@
+#ifndef BH_GALAXY_HH
+#define BH_GALAXY_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "simulation.hh"
+
+namespace bh
+{
+
+// Appends `n` bodies forming a disk in the x/y plane; in 3D it is given a
+// thickness of a tenth of its radius. Bodies are drawn in parallel from a
+// counter-based generator keyed by `seed`, so the same seed gives the same
+// bodies regardless of the number of threads.
+template <typename T, int D>
+void push_galaxy (bh::task_pool_t *pool, bh::point_vector_t<T, D> &points,
+                  int n, std::uint64_t seed, float inital_radius, float speed,
+                  float center_x, float center_y, float base_velocity_x,
+                  float base_velocity_y, float mass);
+
+// Mass profile of one galaxy, centred on its own origin with its disk in the
+// x/y plane. Bodies all weigh the same, so each component gets a share of the
+// bodies equal to its share of `mass`.
+struct galaxy_model_t
+{
+  float mass{ 1e5f };
+
+  // Exponential disk, surface density ~ exp(-R / disk_scale); in 3D with a
+  // sech^2 vertical profile of scale height `disk_height`.
+  float disk_fraction{ 1 };
+  float disk_scale{ 150 };
+  float disk_height{ 15 };
+
+  // Toomre stability parameter the radial dispersion of the disk is set
+  // for; below 1 a disk fragments, so a model should keep it above.
+  float disk_toomre{ 1.5f };
+
+  // Plummer spheres, or Plummer disks in 2D, of the given scale radius.
+  float bulge_fraction{ 0 };
+  float bulge_scale{ 30 };
+  float halo_fraction{ 0 };
+  float halo_scale{ 600 };
+
+  // Every component is truncated at this many of its scale lengths.
+  float cutoff{ 10 };
+};
+
+// One galaxy of a scenario: its model, its placement and its bulk motion.
+struct scenario_galaxy_t
+{
+  bh::galaxy_model_t model{};
+  int bodies{ 100'000 };
+  std::uint64_t seed{ 1 };
+  double position[3]{};
+  double velocity[3]{};
+
+  // Tilt of the disk about the x axis, in radians; 3D only.
+  float inclination{ 0 };
+};
+
+typedef std::vector<bh::scenario_galaxy_t> scenario_t;
+
+// Appends the bodies of `galaxy` with velocities in equilibrium with its own
+// field. The field is that of a tree built over the galaxy alone under
+// `params`, so softening and opening angle are those of the run. Disk bodies
+// get the radial dispersion of `disk_toomre` and the tangential one of the
+// epicyclic approximation around their circular velocity less the
+// asymmetric drift, in 3D plus the vertical dispersion of an isothermal
+// sheet. Bulge and halo bodies get isotropic Gaussian velocities whose
+// dispersion solves the Jeans equation in the radially averaged field.
+template <typename T, int D>
+void push_galaxy_model (bh::task_pool_t *pool,
+                        bh::point_vector_t<T, D> &points,
+                        const bh::scenario_galaxy_t &galaxy,
+                        const bh::params_t &params);
+
+template <typename T, int D>
+void push_scenario (bh::task_pool_t *pool, bh::point_vector_t<T, D> &points,
+                    const bh::scenario_t &scenario,
+                    const bh::params_t &params);
+
+// Fills `scenario` with the preset `name` of `bodies` bodies in total:
+// "disk", "plummer", "milky-way" or "collision", the last being two
+// milky-way galaxies on a parabolic encounter. Returns false for an unknown
+// name.
+bool scenario_preset (const char *name, int bodies, std::uint64_t seed,
+                      const bh::params_t &params, bh::scenario_t *scenario);
+
+#define BH_GALAXY_INSTANTIATE(PREFIX, T, D)                                   \
+  PREFIX template void push_galaxy<T, D> (                                    \
+      bh::task_pool_t *, bh::point_vector_t<T, D> &, int, std::uint64_t,      \
+      float, float, float, float, float, float, float);                        \
+  PREFIX template void push_galaxy_model<T, D> (                              \
+      bh::task_pool_t *, bh::point_vector_t<T, D> &,                          \
+      const bh::scenario_galaxy_t &, const bh::params_t &);                   \
+  PREFIX template void push_scenario<T, D> (                                  \
+      bh::task_pool_t *, bh::point_vector_t<T, D> &, const bh::scenario_t &,  \
+      const bh::params_t &);
+
+BH_GALAXY_INSTANTIATE (extern, float, 2)
+BH_GALAXY_INSTANTIATE (extern, float, 3)
+BH_GALAXY_INSTANTIATE (extern, double, 2)
+BH_GALAXY_INSTANTIATE (extern, double, 3)
+
+}
+
+#endif
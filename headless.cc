@@ -0,0 +1,177 @@
+#include <chrono>
+#include <cstdio>
+
+#include <omp.h>
+
+#include "config.hh"
+#include "frames.hh"
+#include "galaxy.hh"
+#include "initial.hh"
+#include "simulation.hh"
+#include "snapshot.hh"
+#include "task_pool.hh"
+#include "trajectory.hh"
+
+// Runs the engine without a window and prints the time of every step, for
+// compute nodes that have no graphics libraries.
+template <typename T, int D>
+static int
+headless_run (const bh::config_t &config)
+{
+  bh::simulation_t<T, D> sim{};
+  sim.pool = bh::task_pool_init (
+      config.threads > 0 ? config.threads : omp_get_max_threads (),
+      config.pin_threads);
+
+  if (!config.restart.empty ())
+    {
+      if (!bh::snapshot_load (config.restart.c_str (), &sim))
+        return bh::task_pool_free (sim.pool), 1;
+
+      // The checkpoint brings its own parameters; explicit options win.
+      bh::config_apply_params (config, &sim.params);
+    }
+  else
+    {
+      for (int axis = 0; axis < D; ++axis)
+        sim.boundary.corner[axis] = -config.box;
+      sim.boundary.width = config.box * 2;
+
+      sim.params = config.params;
+
+      bh::point_vector_t<T, D> points{};
+      if (!config.initial.empty ())
+        {
+          if (!bh::initial_load<T, D> (config.initial.c_str (), sim.pool,
+                                       &points))
+            return bh::task_pool_free (sim.pool), 1;
+        }
+      else if (!config.scenario.empty ())
+        {
+          bh::scenario_t scenario{};
+          if (!bh::scenario_preset (config.scenario.c_str (), config.bodies,
+                                    config.seed, sim.params, &scenario))
+            {
+              fprintf (stderr, "unknown scenario %s\n",
+                       config.scenario.c_str ());
+              return bh::task_pool_free (sim.pool), 1;
+            }
+
+          bh::push_scenario<T, D> (sim.pool, points, scenario, sim.params);
+        }
+      else
+        bh::push_galaxy<T, D> (sim.pool, points, config.bodies, config.seed,
+                               400, 12, 0, 0, 0, 0, 1.0);
+
+      bh::points_sort_morton<T, D> (sim.pool, &points, sim.boundary);
+      bh::points_copy<T, D> (sim.pool, &sim.points, points);
+    }
+
+  sim.diagnose = config.diagnostics;
+  bh::simulation_configure (&sim);
+
+  bh::trajectory_writer_t<T, D> *recorder = NULL;
+  if (!config.trajectory.empty ())
+    {
+      bh::trajectory_options_t options{};
+      options.velocities = config.trajectory_velocities;
+      options.bits = config.trajectory_bits;
+
+      recorder = bh::trajectory_writer_init<T, D> (config.trajectory.c_str (),
+                                                   sim, options);
+      if (recorder == NULL)
+        return bh::task_pool_free (sim.pool), 1;
+    }
+
+  bh::frame_writer_t<T, D> *movie = NULL;
+  if (!config.frames.empty ())
+    {
+      bh::frame_options_t options{};
+      options.width = config.window_width;
+      options.height = config.window_height;
+      options.scale = config.frame_scale;
+      options.tone = config.tone;
+      options.softness = config.softness;
+      if (config.render_threads > 0)
+        options.threads = config.render_threads;
+
+      movie = bh::frame_writer_init<T, D> (config.frames.c_str (), options);
+      if (movie == NULL)
+        {
+          bh::trajectory_writer_free (recorder);
+          return bh::task_pool_free (sim.pool), 1;
+        }
+    }
+
+  bh::snapshot_writer_t *writer
+      = !config.checkpoint.empty () ? bh::snapshot_writer_init () : NULL;
+
+  bh::diagnostics_t first{};
+  for (int step = 0; step < config.steps; ++step)
+    {
+      auto start = std::chrono::steady_clock::now ();
+
+      bh::simulation_step (&sim);
+
+      if (writer != NULL && sim.steps % config.checkpoint_every == 0)
+        bh::snapshot_writer_submit (writer, config.checkpoint.c_str (), sim);
+
+      if (recorder != NULL && sim.steps % config.trajectory_every == 0)
+        bh::trajectory_writer_push (recorder, sim);
+
+      if (movie != NULL && sim.steps % config.frames_every == 0)
+        bh::frame_writer_push (movie, sim);
+
+      auto end = std::chrono::steady_clock::now ();
+
+      auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (
+          end - start);
+
+      printf ("step %lu %ldms\n", (unsigned long)sim.steps,
+              duration.count ());
+
+      if (sim.diagnose)
+        {
+          if (step == 0)
+            first = sim.diagnostics;
+          bh::diagnostics_print (stdout, sim.diagnostics, first);
+        }
+    }
+
+  bh::frame_writer_free (movie);
+  bh::trajectory_writer_free (recorder);
+  bh::snapshot_writer_free (writer);
+  bh::simulation_finish (&sim);
+  bh::task_pool_free (sim.pool);
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  bh::config_t config{};
+  if (!bh::config_parse (&config, argc, argv))
+    {
+      bh::config_usage (stderr, argv[0]);
+      return 1;
+    }
+
+  // A restart continues in the precision and dimension of the checkpoint.
+  if (!config.restart.empty ())
+    {
+      bh::snapshot_header_t header;
+      if (!bh::snapshot_probe (config.restart.c_str (), &header))
+        return 1;
+
+      config.dimension = header.dimension;
+      config.double_precision = header.scalar_size == sizeof (double);
+    }
+
+  if (config.double_precision)
+    return config.dimension == 3 ? headless_run<double, 3> (config)
+                                 : headless_run<double, 2> (config);
+
+  return config.dimension == 3 ? headless_run<float, 3> (config)
+                               : headless_run<float, 2> (config);
+}
@@ -0,0 +1,320 @@
+#include "initial.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bh
+{
+
+// Text is cut into this many chunks per pool thread, so that lines of uneven
+// length still balance.
+static const std::size_t INITIAL_CHUNKS_PER_THREAD = 8;
+
+static inline bool
+initial_separator (char c)
+{
+  return c == ',' || c == ' ' || c == '\t' || c == '\r';
+}
+
+// Parses up to `max` fields of the line [begin, end) into `fields`. Returns
+// the number of fields, or -1 if one of them is not a number.
+template <typename T>
+static int
+initial_parse_line (const char *begin, const char *end, T *fields, int max)
+{
+  int count = 0;
+  const char *p = begin;
+
+  for (;;)
+    {
+      while (p < end && initial_separator (*p))
+        ++p;
+
+      if (p == end)
+        return count;
+
+      if (count == max)
+        return -1;
+
+      // `from_chars` takes no explicit plus sign.
+      if (*p == '+')
+        ++p;
+
+      const auto result = std::from_chars (p, end, fields[count]);
+      if (result.ec != std::errc ()
+          || (result.ptr < end && !initial_separator (*result.ptr)))
+        return -1;
+
+      p = result.ptr;
+      ++count;
+    }
+}
+
+template <typename T, int D>
+static bool
+initial_load_text (const char *path, bh::task_pool_t *pool, const char *text,
+                   std::size_t size, bh::point_vector_t<T, D> *points)
+{
+  const char *const end = text + size;
+
+  // The first line that is neither empty nor a comment decides whether
+  // velocities are given; if it does not parse, it is a header.
+  const char *data = text;
+  int fields = -1;
+  bool header_checked = false;
+  while (data < end)
+    {
+      const char *eol = static_cast<const char *> (
+          std::memchr (data, '\n', end - data));
+      if (eol == NULL)
+        eol = end;
+
+      const char *p = data;
+      while (p < eol && initial_separator (*p))
+        ++p;
+
+      if (p < eol && *p != '#')
+        {
+          T values[1 + 2 * D];
+          fields = bh::initial_parse_line (p, eol, values, 1 + 2 * D);
+          if (fields == 1 + D || fields == 1 + 2 * D)
+            break;
+
+          if (fields >= 0 || header_checked)
+            {
+              fprintf (stderr, "initial: %s: expected %d or %d fields\n",
+                       path, 1 + D, 1 + 2 * D);
+              return false;
+            }
+        }
+
+      if (p < eol && *p != '#')
+        header_checked = true;
+
+      data = eol < end ? eol + 1 : end;
+    }
+
+  if (data == end)
+    {
+      fprintf (stderr, "initial: %s holds no bodies\n", path);
+      return false;
+    }
+
+  // Chunks start just past a newline, so every line belongs to exactly one.
+  const std::size_t chunks
+      = bh::task_pool_size (pool) * bh::INITIAL_CHUNKS_PER_THREAD;
+  std::vector<const char *> starts{ data };
+  for (std::size_t c = 1; c < chunks; ++c)
+    {
+      const char *p = data + (end - data) * c / chunks;
+      if (p <= starts.back ())
+        continue;
+
+      const char *eol = static_cast<const char *> (
+          std::memchr (p - 1, '\n', end - (p - 1)));
+      if (eol == NULL || eol + 1 >= end)
+        break;
+
+      if (eol + 1 > starts.back ())
+        starts.push_back (eol + 1);
+    }
+  starts.push_back (end);
+
+  const std::size_t parts = starts.size () - 1;
+  std::vector<std::vector<bh::point_t<T, D> > > parsed (parts);
+
+  // Offset of the first bad line, or `size` if there is none.
+  std::atomic<std::size_t> error{ size };
+
+  bh::task_pool_parallel_for (
+      pool, parts, 1, [&] (std::size_t begin, std::size_t stop) {
+        for (std::size_t c = begin; c < stop; ++c)
+          {
+            std::vector<bh::point_t<T, D> > &out = parsed[c];
+            out.reserve ((starts[c + 1] - starts[c]) / (8 * (1 + D)));
+
+            const char *line = starts[c];
+            while (line < starts[c + 1])
+              {
+                const char *eol = static_cast<const char *> (
+                    std::memchr (line, '\n', starts[c + 1] - line));
+                if (eol == NULL)
+                  eol = starts[c + 1];
+
+                const char *p = line;
+                while (p < eol && initial_separator (*p))
+                  ++p;
+
+                if (p < eol && *p != '#')
+                  {
+                    T values[1 + 2 * D];
+                    if (bh::initial_parse_line (p, eol, values, fields)
+                        != fields)
+                      {
+                        std::size_t offset = line - text;
+                        std::size_t first = error.load ();
+                        while (offset < first
+                               && !error.compare_exchange_weak (first,
+                                                                offset))
+                          ;
+                        break;
+                      }
+
+                    bh::vec_t<T, D> position{}, velocity{};
+                    for (int axis = 0; axis < D; ++axis)
+                      {
+                        position[axis] = values[1 + axis];
+                        if (fields == 1 + 2 * D)
+                          velocity[axis] = values[1 + D + axis];
+                      }
+
+                    out.push_back (
+                        bh::point_init<T, D> (values[0], position, velocity));
+                  }
+
+                line = eol + 1;
+              }
+          }
+      });
+
+  if (error.load () < size)
+    {
+      const std::size_t line
+          = 1 + std::count (text, text + error.load (), '\n');
+      fprintf (stderr, "initial: %s: cannot parse line %zu\n", path, line);
+      return false;
+    }
+
+  std::vector<std::size_t> offsets (parts + 1, 0);
+  for (std::size_t c = 0; c < parts; ++c)
+    offsets[c + 1] = offsets[c] + parsed[c].size ();
+
+  points->resize (offsets[parts]);
+  bh::task_pool_parallel_for (
+      pool, parts, 1, [&] (std::size_t begin, std::size_t stop) {
+        for (std::size_t c = begin; c < stop; ++c)
+          std::copy (parsed[c].begin (), parsed[c].end (),
+                     points->begin () + offsets[c]);
+      });
+
+  return true;
+}
+
+template <typename T, int D, typename S>
+static bool
+initial_load_columns (const char *path, bh::task_pool_t *pool,
+                      const char *data, std::size_t size,
+                      bh::point_vector_t<T, D> *points)
+{
+  const std::size_t row = (1 + 2 * D) * sizeof (S);
+  if (size == 0 || size % row != 0)
+    {
+      fprintf (stderr, "initial: %s does not hold %d whole columns\n", path,
+               1 + 2 * D);
+      return false;
+    }
+
+  const std::size_t n = size / row;
+  auto column = [&] (int c, std::size_t i) {
+    S value;
+    std::memcpy (&value, data + (c * n + i) * sizeof (S), sizeof (S));
+    return static_cast<T> (value);
+  };
+
+  points->resize (n);
+  bh::task_pool_parallel_for (
+      pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            bh::point_t<T, D> &point = (*points)[i];
+            point.mass = column (0, i);
+            for (int axis = 0; axis < D; ++axis)
+              {
+                point.position[axis] = column (1 + axis, i);
+                point.velocity[axis] = column (1 + D + axis, i);
+              }
+          }
+      });
+
+  return true;
+}
+
+static bool
+initial_has_suffix (const char *path, const char *suffix)
+{
+  const std::size_t length = std::strlen (path);
+  const std::size_t suffix_length = std::strlen (suffix);
+  return length >= suffix_length
+         && std::strcmp (path + length - suffix_length, suffix) == 0;
+}
+
+// Asks for read-ahead of a file that is parsed front to back. Each advice
+// takes a call of its own, and either may be refused without harm.
+static void
+initial_advise_sequential (void *map, std::size_t size)
+{
+  (void)madvise (map, size, MADV_SEQUENTIAL);
+  (void)madvise (map, size, MADV_WILLNEED);
+}
+
+template <typename T, int D>
+bool
+initial_load (const char *path, bh::task_pool_t *pool,
+              bh::point_vector_t<T, D> *points)
+{
+  const int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf (stderr, "initial: cannot open %s\n", path);
+      return false;
+    }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || st.st_size == 0)
+    {
+      fprintf (stderr, "initial: %s is empty\n", path);
+      close (fd);
+      return false;
+    }
+
+  const std::size_t size = st.st_size;
+  void *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    {
+      fprintf (stderr, "initial: cannot map %s\n", path);
+      return false;
+    }
+
+  bh::initial_advise_sequential (map, size);
+
+  const char *data = static_cast<const char *> (map);
+  bool ok;
+  if (bh::initial_has_suffix (path, ".f32"))
+    ok = bh::initial_load_columns<T, D, float> (path, pool, data, size,
+                                                points);
+  else if (bh::initial_has_suffix (path, ".f64"))
+    ok = bh::initial_load_columns<T, D, double> (path, pool, data, size,
+                                                 points);
+  else
+    ok = bh::initial_load_text<T, D> (path, pool, data, size, points);
+
+  munmap (map, size);
+  return ok;
+}
+
+BH_INITIAL_INSTANTIATE (, float, 2)
+BH_INITIAL_INSTANTIATE (, float, 3)
+BH_INITIAL_INSTANTIATE (, double, 2)
+BH_INITIAL_INSTANTIATE (, double, 3)
+
+}
@@ -0,0 +1,35 @@
+#ifndef BH_INITIAL_HH
+#define BH_INITIAL_HH
+
+#include "task_pool.hh"
+#include "tree.hh"
+
+namespace bh
+{
+
+// Loads initial conditions from `path` into `points`, replacing its contents.
+//
+// Files ending in `.f32` or `.f64` hold raw little-endian columns of that
+// scalar type, one after the other: mass, the D position axes, then the D
+// velocity axes, so the body count follows from the file size.
+//
+// Anything else is read as text with one body per line, fields separated by
+// commas or blanks: mass, the D position axes and, optionally, the D
+// velocity axes. Empty lines, lines starting with `#`, and a header on the
+// first line are skipped. Text is parsed in parallel chunks on `pool`.
+template <typename T, int D>
+bool initial_load (const char *path, bh::task_pool_t *pool,
+                   bh::point_vector_t<T, D> *points);
+
+#define BH_INITIAL_INSTANTIATE(PREFIX, T, D)                                  \
+  PREFIX template bool initial_load<T, D> (const char *, bh::task_pool_t *,   \
+                                           bh::point_vector_t<T, D> *);
+
+BH_INITIAL_INSTANTIATE (extern, float, 2)
+BH_INITIAL_INSTANTIATE (extern, float, 3)
+BH_INITIAL_INSTANTIATE (extern, double, 2)
+BH_INITIAL_INSTANTIATE (extern, double, 3)
+
+}
+
+#endif
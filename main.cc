@@ -1,233 +1,787 @@
+#include <array>
 #include <atomic>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <mutex>
-#include <optional>
 #include <thread>
+#include <vector>
+
+#include <omp.h>
+#include <unistd.h>
+
+#include "config.hh"
+#include "density.hh"
+#include "galaxy.hh"
+#include "initial.hh"
+#include "metrics.hh"
+#include "simulation.hh"
+#include "snapshot.hh"
+#include "task_pool.hh"
+#include "trajectory.hh"
 
 #include <SFML/Graphics.hpp>
 
-namespace bh
+// The viewer shows 3D runs projected onto the x/y plane.
+template <typename T, int D>
+static inline sf::Vector2f
+view_project (const bh::vec_t<T, D> &position)
 {
+  return { static_cast<float> (position[0]), static_cast<float> (position[1]) };
+}
 
-float THETA;
-float GRAVITY_CONSTANT;
-float TIME_STEP;
-float SOFTENING;
+// Body colour; under additive blending every body adds `BODY_COLOR * alpha`
+// to its pixel.
+static const sf::Color BODY_COLOR{ 92, 106, 114, 128 };
 
-struct point_t
+// Whether the projection of `box` overlaps `visible`.
+template <typename T, int D>
+static inline bool
+view_overlaps (const bh::box_t<T, D> &box, const sf::FloatRect &visible)
 {
-  float mass;
-  sf::Vector2f position;
-  sf::Vector2f velocity;
+  const sf::Vector2f corner = view_project (box.corner);
+  const float width = static_cast<float> (box.width);
+
+  return corner.x <= visible.left + visible.width
+         && corner.x + width >= visible.left
+         && corner.y <= visible.top + visible.height
+         && corner.y + width >= visible.top;
+}
+
+// Colour map of the per-body quantities, from low to high: blue, the body
+// colour, orange, then near white.
+static const float COLOR_PALETTE[][3] = {
+  { 40, 60, 140 },
+  { 92, 106, 114 },
+  { 230, 140, 50 },
+  { 255, 244, 230 },
 };
 
-static inline bh::point_t
-point_init (float mass, const sf::Vector2f &position,
-            const sf::Vector2f &velocity = { 0.f, 0.f })
+static inline sf::Color
+view_palette (float shade)
 {
-  return (
-      bh::point_t){ .mass = mass, .position = position, .velocity = velocity };
+  constexpr int STOPS = sizeof (COLOR_PALETTE) / sizeof (*COLOR_PALETTE);
+
+  const float t = std::clamp (shade, 0.f, 1.f) * (STOPS - 1);
+  const int s = std::min (static_cast<int> (t), STOPS - 2);
+  const float f = t - s;
+  const float *lo = COLOR_PALETTE[s];
+  const float *hi = COLOR_PALETTE[s + 1];
+  const auto channel = [lo, hi, f] (int k) {
+    return static_cast<sf::Uint8> (lo[k] + (hi[k] - lo[k]) * f);
+  };
+
+  return sf::Color (channel (0), channel (1), channel (2), BODY_COLOR.a);
 }
 
-struct quad_node_t
+// Interpolates bodies [begin, end) between two snapshots and writes the
+// vertices of those inside `visible` to `out`, or only counts them if `out`
+// is NULL. Bodies take their colour from `shades` unless it is NULL. Returns
+// their number.
+template <typename T, int D>
+static std::size_t
+view_interpolate (const bh::point_vector_t<T, D> &previous,
+                  const bh::point_vector_t<T, D> &current, float alpha,
+                  const float *shades, const sf::FloatRect &visible,
+                  std::size_t begin, std::size_t end, sf::Vertex *out)
 {
-  alignas (8) float total_mass{ 0.f };
-  sf::Vector2f center_of_mass{ 0.f, 0.f };
-  sf::FloatRect boundary{};
-  std::optional<bh::point_t> point{};
-  bh::quad_node_t *children[4]{ 0, 0, 0, 0 };
-};
+  std::size_t count = 0;
+  for (std::size_t i = begin; i < end; ++i)
+    {
+      const sf::Vector2f prev = view_project (previous[i].position);
+      const sf::Vector2f curr = view_project (current[i].position);
+      const sf::Vector2f position = prev + (curr - prev) * alpha;
+
+      if (!visible.contains (position))
+        continue;
+
+      if (out != NULL)
+        out[count] = sf::Vertex (position, shades != NULL
+                                               ? view_palette (shades[i])
+                                               : BODY_COLOR);
+      ++count;
+    }
 
-static inline bh::quad_node_t *
-quad_node_init (const sf::FloatRect &boundary)
-{
-  auto *node = new bh::quad_node_t{};
-  return node->boundary = boundary, node;
+  return count;
 }
 
-static inline void
-quad_node_free (bh::quad_node_t *node)
+// Index of the deepest node of `tree` whose box holds `position`; a leaf,
+// and so a single body, unless no body of the tree lies there.
+template <typename T, int D>
+static std::size_t
+view_leaf (const bh::tree_flat_t<T, D> &tree, const bh::vec_t<T, D> &position)
 {
-  if (node == NULL)
-    return;
+  std::size_t index = 0;
+  for (bool found = true; found && tree[index].count > 0;)
+    {
+      const bh::tree_flat_node_t<T, D> &node = tree[index];
+      found = false;
+      for (std::uint32_t k = 0; !found && k < node.count; ++k)
+        if (bh::box_contains (tree[node.first + k].boundary, position))
+          index = node.first + k, found = true;
+    }
 
-  for (auto child : node->children)
-    quad_node_free (child);
+  return index;
+}
 
-  delete node;
+// Mass over volume of the leaf of `tree` that `position` falls in; leaves
+// hold one body, or several coincident ones, so their size follows the
+// local density.
+template <typename T, int D>
+static T
+view_leaf_density (const bh::tree_flat_t<T, D> &tree,
+                   const bh::vec_t<T, D> &position)
+{
+  const bh::tree_flat_node_t<T, D> &leaf = tree[view_leaf (tree, position)];
+  return leaf.total_mass / std::pow (leaf.boundary.width, D);
 }
 
-static inline bool
-quad_node_is_leaf (const bh::quad_node_t &node)
+// Shade in [0, 1] of every body for `color`: the log of the quantity, with
+// two standard deviations either side of its mean spanning the colour map.
+// Acceleration is the change of velocity between the snapshots and density
+// is looked up in `tree`, which was built over `previous`; `cost` holds the
+// interactions each body's force took. Bodies without the quantity, as
+// during replay, get shade 0.
+template <typename T, int D>
+static void
+view_shades (bh::task_pool_t *pool, bh::color_t color,
+             const bh::point_vector_t<T, D> &previous,
+             const bh::point_vector_t<T, D> &current,
+             const bh::tree_flat_t<T, D> &tree,
+             const std::vector<unsigned> &cost, std::vector<float> *shades)
 {
-  return std::all_of (node.children, node.children + 4,
-                      [] (const auto &child) { return child == NULL; });
+  const std::size_t n = current.size ();
+  const std::size_t grain = 16384;
+  const std::size_t chunks = (n + grain - 1) / grain;
+
+  const auto quantity = [&] (std::size_t i) -> double {
+    switch (color)
+      {
+      case bh::COLOR_SPEED:
+        return std::sqrt (bh::dot (current[i].velocity, current[i].velocity));
+      case bh::COLOR_ACCELERATION:
+        {
+          const bh::vec_t<T, D> kick
+              = current[i].velocity - previous[i].velocity;
+          return std::sqrt (bh::dot (kick, kick));
+        }
+      case bh::COLOR_DENSITY:
+        return tree.empty () ? 0
+                             : view_leaf_density (tree, previous[i].position);
+      case bh::COLOR_COST:
+        return cost.size () == n ? cost[i] : 0;
+      default:
+        return 0;
+      }
+  };
+
+  // Logs of the quantity, with their sum, sum of squares and count per
+  // chunk; non-positive values are marked with -infinity.
+  shades->resize (n);
+  std::vector<double> chunk_sum (chunks, 0.0);
+  std::vector<double> chunk_squares (chunks, 0.0);
+  std::vector<std::size_t> chunk_used (chunks, 0);
+  bh::task_pool_parallel_for (
+      pool, n, grain, [&] (std::size_t begin, std::size_t end) {
+        const std::size_t c = begin / grain;
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            const double q = quantity (i);
+            if (!(q > 0))
+              {
+                (*shades)[i] = -INFINITY;
+                continue;
+              }
+
+            const double l = std::log (q);
+            (*shades)[i] = static_cast<float> (l);
+            chunk_sum[c] += l;
+            chunk_squares[c] += l * l;
+            chunk_used[c]++;
+          }
+      });
+
+  double sum = 0, squares = 0;
+  std::size_t used = 0;
+  for (std::size_t c = 0; c < chunks; ++c)
+    {
+      sum += chunk_sum[c];
+      squares += chunk_squares[c];
+      used += chunk_used[c];
+    }
+
+  const double mean = used > 0 ? sum / used : 0;
+  const double spread
+      = used > 0 ? std::sqrt (std::max (squares / used - mean * mean, 0.0))
+                 : 0;
+  const float low = static_cast<float> (mean - 2 * spread);
+  const float range = static_cast<float> (std::max (4 * spread, 1e-6));
+
+  bh::task_pool_parallel_for (
+      pool, n, grain, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          (*shades)[i] = std::clamp (((*shades)[i] - low) / range, 0.f, 1.f);
+      });
 }
 
-static inline void
-quad_node_subdivide (bh::quad_node_t *node)
+// Vertices of the bodies inside `visible`. Every chunk of bodies is counted
+// first, so that the chunks then write their vertices in parallel, each to
+// its own place.
+template <typename T, int D>
+static void
+view_bodies (bh::task_pool_t *pool, const bh::point_vector_t<T, D> &previous,
+             const bh::point_vector_t<T, D> &current, float alpha,
+             const float *shades, const sf::FloatRect &visible,
+             std::vector<sf::Vertex> *out)
 {
-  const sf::Vector2f center{ node->boundary.left + node->boundary.width / 2,
-                             node->boundary.top + node->boundary.height / 2 };
-
-  const sf::FloatRect quadrants[4]
-      = { { node->boundary.left, node->boundary.top, node->boundary.width / 2,
-            node->boundary.height / 2 },
-          { center.x, node->boundary.top, node->boundary.width / 2,
-            node->boundary.height / 2 },
-          { node->boundary.left, center.y, node->boundary.width / 2,
-            node->boundary.height / 2 },
-          { center.x, center.y, node->boundary.width / 2,
-            node->boundary.height / 2 } };
-
-  unsigned char index = 0;
-  for (auto &child : node->children)
-    child = bh::quad_node_init (quadrants[(index++) % 4]);
+  const std::size_t grain = 16384;
+  const std::size_t chunks = (current.size () + grain - 1) / grain;
+
+  std::vector<std::size_t> offsets (chunks + 1, 0);
+  const auto chunk_pass = [&] (bool write) {
+    bh::task_pool_parallel_for (
+        pool, chunks, 1, [&] (std::size_t begin, std::size_t end) {
+          for (std::size_t c = begin; c < end; ++c)
+            {
+              const std::size_t first = c * grain;
+              const std::size_t last = std::min (first + grain,
+                                                 current.size ());
+              const std::size_t count = view_interpolate (
+                  previous, current, alpha, shades, visible, first, last,
+                  write ? out->data () + offsets[c] : NULL);
+              if (!write)
+                offsets[c + 1] = count;
+            }
+        });
+  };
+
+  chunk_pass (false);
+  for (std::size_t c = 0; c < chunks; ++c)
+    offsets[c + 1] += offsets[c];
+
+  out->resize (offsets.back ());
+  chunk_pass (true);
 }
 
-static inline void
-quad_node_insert (bh::quad_node_t *node, const bh::point_t &point)
+// Appends one splat for every node below `index` that is a single body or
+// narrower than `pixel`, at its centre of mass and as bright as the bodies
+// it stands for together, `unit` being the mass of one body.
+template <typename T, int D>
+static void
+view_splats (const bh::tree_flat_t<T, D> &tree, std::size_t index, T pixel,
+             T unit, const sf::FloatRect &visible,
+             std::vector<sf::Vertex> *out)
 {
-  if (!node->boundary.contains (point.position))
+  const bh::tree_flat_node_t<T, D> &node = tree[index];
+  if (!view_overlaps (node.boundary, visible))
     return;
 
-  if (bh::quad_node_is_leaf (*node))
+  if (node.count > 0 && node.boundary.width > pixel)
     {
-      if (!node->point.has_value ())
-        return node->point = point, (void)0;
+      for (std::uint32_t k = 0; k < node.count; ++k)
+        view_splats (tree, node.first + k, pixel, unit, visible, out);
+      return;
+    }
 
-      bh::quad_node_subdivide (node);
+  const float weight
+      = static_cast<float> (node.total_mass / unit) * BODY_COLOR.a / 255.f;
+  const auto channel = [weight] (sf::Uint8 c) {
+    return static_cast<sf::Uint8> (std::min (255.f, c * weight));
+  };
 
-      const bh::point_t save = node->point.value ();
-      node->point.reset ();
+  out->emplace_back (view_project (node.center_of_mass),
+                     sf::Color (channel (BODY_COLOR.r), channel (BODY_COLOR.g),
+                                channel (BODY_COLOR.b), 255));
+}
+
+// Level-of-detail vertices of the part of `tree` inside `visible`: subtrees
+// off screen are skipped whole, those a few levels down are split between
+// the threads of `pool`, then their splats are joined.
+template <typename T, int D>
+static void
+view_lod (bh::task_pool_t *pool, const bh::tree_flat_t<T, D> &tree, T pixel,
+          T unit, const sf::FloatRect &visible, std::vector<sf::Vertex> *out)
+{
+  out->clear ();
+  if (tree.empty ())
+    return;
+
+  const auto whole = [&] (std::size_t index) {
+    return tree[index].count == 0 || tree[index].boundary.width <= pixel;
+  };
 
-      for (auto child : node->children)
-        bh::quad_node_insert (child, save);
+  std::vector<std::size_t> frontier{ 0 };
+  const std::size_t wanted = bh::task_pool_size (pool) * 16;
+  for (bool split = true; split && frontier.size () < wanted;)
+    {
+      std::vector<std::size_t> next{};
+      split = false;
+      for (std::size_t index : frontier)
+        if (!view_overlaps (tree[index].boundary, visible))
+          continue;
+        else if (whole (index))
+          next.push_back (index);
+        else
+          {
+            for (std::uint32_t k = 0; k < tree[index].count; ++k)
+              next.push_back (tree[index].first + k);
+            split = true;
+          }
+
+      frontier.swap (next);
     }
 
-  for (auto child : node->children)
-    bh::quad_node_insert (child, point);
+  std::vector<std::vector<sf::Vertex> > parts (frontier.size ());
+  bh::task_pool_parallel_for (pool, frontier.size (), 1,
+                              [&] (std::size_t begin, std::size_t end) {
+                                for (std::size_t c = begin; c < end; ++c)
+                                  view_splats (tree, frontier[c], pixel,
+                                               unit, visible, &parts[c]);
+                              });
+
+  std::vector<std::size_t> offsets (parts.size () + 1, 0);
+  for (std::size_t c = 0; c < parts.size (); ++c)
+    offsets[c + 1] = offsets[c] + parts[c].size ();
+
+  out->resize (offsets.back ());
+  bh::task_pool_parallel_for (pool, parts.size (), 1,
+                              [&] (std::size_t begin, std::size_t end) {
+                                for (std::size_t c = begin; c < end; ++c)
+                                  std::copy (parts[c].begin (),
+                                             parts[c].end (),
+                                             out->begin () + offsets[c]);
+                              });
 }
 
-static inline void
-quad_node_compute_mass (bh::quad_node_t *node)
+// Force cost of every subtree of `tree`: the interactions, from `cost`, that
+// the bodies below each node took in the step that built it over `points`.
+// Leaves are found in parallel; coincident bodies share one, so their costs
+// meet there through atomic adds. Children are stored after their parent,
+// so one backward sweep then sums the subtrees.
+template <typename T, int D>
+static void
+view_subtree_cost (bh::task_pool_t *pool, const bh::tree_flat_t<T, D> &tree,
+                   const bh::point_vector_t<T, D> &points,
+                   const std::vector<unsigned> &cost,
+                   std::vector<double> *out)
 {
-  if (bh::quad_node_is_leaf (*node))
+  out->assign (tree.size (), 0.0);
+  if (tree.empty () || cost.size () != points.size ())
+    return;
+
+  std::vector<std::atomic<std::uint64_t> > leaves (tree.size ());
+  bh::task_pool_parallel_for (
+      pool, points.size (), 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            const std::size_t leaf = view_leaf (tree, points[i].position);
+            if (tree[leaf].count == 0
+                && tree[leaf].center_of_mass == points[i].position)
+              leaves[leaf].fetch_add (cost[i], std::memory_order_relaxed);
+          }
+      });
+
+  for (std::size_t index = tree.size (); index-- > 0;)
     {
-      if (node->point.has_value ())
+      (*out)[index] = leaves[index].load (std::memory_order_relaxed);
+      for (std::uint32_t k = 0; k < tree[index].count; ++k)
+        (*out)[index] += (*out)[tree[index].first + k];
+    }
+}
+
+// Outlines of the nodes of `tree` inside `visible`, down to `depth` levels
+// below the root and no narrower than a few pixels, as line vertices. Each
+// is coloured by its subtree cost against the mean of the outlined nodes of
+// its level, from a sixteenth to sixteen times that.
+template <typename T, int D>
+static void
+view_overlay (const bh::tree_flat_t<T, D> &tree,
+              const std::vector<double> &subtree_cost, int depth, T pixel,
+              const sf::FloatRect &visible, std::vector<sf::Vertex> *out)
+{
+  out->clear ();
+  if (tree.empty ())
+    return;
+
+  std::vector<std::vector<std::size_t> > levels (depth + 1);
+  levels[0].push_back (0);
+  for (int level = 0; level < depth; ++level)
+    for (std::size_t index : levels[level])
+      for (std::uint32_t k = 0; k < tree[index].count; ++k)
         {
-          node->center_of_mass = node->point->position;
-          node->total_mass = node->point->mass;
+          const bh::tree_flat_node_t<T, D> &child
+              = tree[tree[index].first + k];
+          if (child.boundary.width >= 4 * pixel
+              && view_overlaps (child.boundary, visible))
+            levels[level + 1].push_back (tree[index].first + k);
         }
 
-      return;
+  for (const auto &level : levels)
+    {
+      double mean = 0;
+      for (std::size_t index : level)
+        mean += subtree_cost[index] / level.size ();
+
+      for (std::size_t index : level)
+        {
+          const double ratio = subtree_cost[index] / std::max (mean, 1.0);
+          const float shade = static_cast<float> (
+              0.5 + std::log2 (std::max (ratio, 1e-3)) / 8);
+          const sf::Color color = view_palette (shade);
+
+          const bh::box_t<T, D> &box = tree[index].boundary;
+          const sf::Vector2f corner = view_project (box.corner);
+          const float w = static_cast<float> (box.width);
+          const sf::Vector2f corners[4]
+              = { corner, corner + sf::Vector2f (w, 0),
+                  corner + sf::Vector2f (w, w), corner + sf::Vector2f (0, w) };
+          for (int edge = 0; edge < 4; ++edge)
+            {
+              out->emplace_back (corners[edge], color);
+              out->emplace_back (corners[(edge + 1) % 4], color);
+            }
+        }
     }
+}
+
+// 3x5 pixel glyphs of the HUD, one bit per pixel row after row from the top
+// left, for the characters of HUD_GLYPHS in that order.
+static const char HUD_GLYPHS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ./:-";
+static const std::uint16_t HUD_FONT[] = {
+  0x7b6f, 0x2c97, 0x73e7, 0x72cf, 0x5bc9, 0x79cf, 0x79ef, 0x7292, 0x7bef,
+  0x7bcf, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b, 0x5bed,
+  0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a, 0x6ba4, 0x2b73,
+  0x6bad, 0x388e, 0x7492, 0x5b6f, 0x5b6a, 0x5bfd, 0x5aad, 0x5a92, 0x72a7,
+  0x0002, 0x12a4, 0x0410, 0x01c0,
+};
 
-  node->center_of_mass = { 0.f, 0.f };
-  node->total_mass = 0;
+// Samples each HUD graph keeps, one bar of `HUD_BAR` pixels each.
+static const std::size_t HUD_HISTORY = 120;
+static const float HUD_BAR = 2;
+static const float HUD_HEIGHT = 32;
 
-  for (auto child : node->children)
+// Colours of the stacked series of a graph, bottom up.
+static const sf::Color HUD_COLORS[] = { { 90, 140, 230 },
+                                        { 110, 200, 120 },
+                                        { 240, 160, 60 },
+                                        { 160, 160, 160 } };
+
+// Rolling history of one HUD graph. Every sample stacks up to four series;
+// `legend` names them, one letter each.
+struct hud_graph_t
+{
+  const char *label;
+  const char *legend;
+  std::deque<std::array<float, 4> > samples{};
+};
+
+static void
+hud_push (hud_graph_t *graph, const std::array<float, 4> &sample)
+{
+  graph->samples.push_back (sample);
+  if (graph->samples.size () > HUD_HISTORY)
+    graph->samples.pop_front ();
+}
+
+static void
+hud_rect (float x, float y, float w, float h, sf::Color color,
+          std::vector<sf::Vertex> *out)
+{
+  out->emplace_back (sf::Vector2f (x, y), color);
+  out->emplace_back (sf::Vector2f (x + w, y), color);
+  out->emplace_back (sf::Vector2f (x + w, y + h), color);
+  out->emplace_back (sf::Vector2f (x, y + h), color);
+}
+
+// Appends `text` at (x, y), `scale` pixels per glyph pixel, as quads.
+// Characters without a glyph are left blank. Returns the x it ends at.
+static float
+hud_text (float x, float y, float scale, const char *text, sf::Color color,
+          std::vector<sf::Vertex> *out)
+{
+  for (const char *c = text; *c != '\0'; ++c, x += 4 * scale)
     {
-      bh::quad_node_compute_mass (child);
-      node->total_mass += child->total_mass;
-      node->center_of_mass += child->center_of_mass * child->total_mass;
+      const char *glyph = std::strchr (HUD_GLYPHS, *c);
+      if (*c == ' ' || glyph == NULL)
+        continue;
+
+      const std::uint16_t bits = HUD_FONT[glyph - HUD_GLYPHS];
+      for (int pixel = 0; pixel < 15; ++pixel)
+        if (bits & (1 << (14 - pixel)))
+          hud_rect (x + pixel % 3 * scale, y + pixel / 3 * scale, scale,
+                    scale, color, out);
     }
 
-  if (node->total_mass > 0)
-    node->center_of_mass /= node->total_mass;
+  return x;
 }
 
-static inline void
-quad_node_compute_force (const quad_node_t &node, point_t *point)
+// One graph: its label, legend and newest total, then a bar per sample
+// scaled to the largest total in the history.
+static void
+hud_graph (float x, float y, const hud_graph_t &graph,
+           std::vector<sf::Vertex> *out)
 {
-  if (node.total_mass == 0 || point->position == node.center_of_mass)
-    return;
+  const sf::Color text{ 220, 220, 220 };
 
-  const sf::Vector2f direction = node.center_of_mass - point->position;
-  const float distance
-      = std::sqrt (direction.x * direction.x + direction.y * direction.y
-                   + bh::SOFTENING * bh::SOFTENING);
+  float total = 0, top = 0;
+  for (const auto &sample : graph.samples)
+    {
+      total = sample[0] + sample[1] + sample[2] + sample[3];
+      top = std::max (top, total);
+    }
 
-  const float ratio = node.boundary.width / distance;
-  if (bh::quad_node_is_leaf (node) || ratio < THETA)
+  char value[32];
+  std::snprintf (value, sizeof (value), " %.1f", total);
+  float end = hud_text (x, y, 2, graph.label, text, out);
+  end = hud_text (end, y, 2, value, text, out);
+  for (int s = 0; graph.legend[s] != '\0'; ++s)
     {
-      const float force
-          = bh::GRAVITY_CONSTANT * node.total_mass * point->mass
-            / (distance * distance + bh::SOFTENING * bh::SOFTENING);
-      const sf::Vector2f acceleration
-          = direction / distance * force / point->mass;
-      point->velocity += acceleration * bh::TIME_STEP;
+      const char letter[] = { ' ', graph.legend[s], '\0' };
+      end = hud_text (end, y, 2, letter, HUD_COLORS[s], out);
     }
-  else
+
+  const float base = y + 12 + HUD_HEIGHT;
+  hud_rect (x, base, HUD_HISTORY * HUD_BAR, 1, sf::Color (80, 80, 80), out);
+  if (!(top > 0))
+    return;
+
+  float bar = x + (HUD_HISTORY - graph.samples.size ()) * HUD_BAR;
+  for (const auto &sample : graph.samples)
     {
-      for (auto child : node.children)
-        bh::quad_node_compute_force (*child, point);
+      float height = 0;
+      for (int s = 0; s < 4; ++s)
+        {
+          const float h = sample[s] / top * HUD_HEIGHT;
+          hud_rect (bar, base - height - h, HUD_BAR, h, HUD_COLORS[s], out);
+          height += h;
+        }
+      bar += HUD_BAR;
     }
 }
 
-}
+// Panel of all graphs, top left of the window, as quads.
+static void
+hud_build (const std::vector<hud_graph_t> &graphs,
+           std::vector<sf::Vertex> *out)
+{
+  const float row = 12 + HUD_HEIGHT + 8;
 
-#define QT_SIZE 160000
+  out->clear ();
+  hud_rect (0, 0, HUD_HISTORY * HUD_BAR + 16, graphs.size () * row + 8,
+            sf::Color (0, 0, 0, 160), out);
+  for (std::size_t g = 0; g < graphs.size (); ++g)
+    hud_graph (8, 8 + g * row, graphs[g], out);
+}
 
-void
-push_galaxy (std::vector<bh::point_t> &points, int n, float inital_radius,
-             float speed, float center_x, float center_y,
-             float base_velocity_x, float base_velocity_y,
-             float mass)
+// Resident memory of the process, in megabytes.
+static float
+hud_resident_mb ()
 {
-  for (int i = 0; i < n; ++i)
-    {
-      float angle = static_cast<float> (std::rand () % 360) * (M_PI / 180.0f);
-      float radius = static_cast<float> (std::rand ()) / RAND_MAX;
-      radius = sqrtf (radius) * inital_radius;
-
-      float x = center_x + cosf (angle) * radius;
-      float y = center_y + sinf (angle) * radius;
+  FILE *file = std::fopen ("/proc/self/statm", "r");
+  if (file == NULL)
+    return 0;
 
-      float dx = center_x - x, dy = center_y - y;
-      float normal_angle = atan2f (dy, dx) - M_PI / 2;
+  unsigned long size = 0, resident = 0;
+  const int read = std::fscanf (file, "%lu %lu", &size, &resident);
+  std::fclose (file);
 
-      points.emplace_back (bh::point_init (
-          mass, { x, y },
-          {
-              base_velocity_x
-                  + cosf (normal_angle) * speed * (radius / inital_radius),
-              base_velocity_y
-                  + sinf (normal_angle) * speed * (radius / inital_radius),
-          }));
-    }
+  return read == 2 ? resident * (sysconf (_SC_PAGESIZE) / 1048576.f) : 0;
 }
 
-int
-main ()
+template <typename T, int D>
+static int
+viewer_run (const bh::config_t &config)
 {
-  srand(time(nullptr));
-  sf::RenderWindow window{ sf::VideoMode{ 800, 800 }, "Barnes-Hut Simulation",
-                           sf::Style::Titlebar,
+  const int width = config.window_width, height = config.window_height;
+
+  sf::RenderWindow window{ sf::VideoMode (width, height),
+                           "Barnes-Hut Simulation", sf::Style::Titlebar,
                            sf::ContextSettings{ 24, 8, 8 } };
   window.setFramerateLimit (60);
-  window.setPosition ({ 1920 / 2 - 400, 1080 / 2 - 400 });
+  window.setPosition ({ 1920 / 2 - width / 2, 1080 / 2 - height / 2 });
+
+  // Vertices of the bodies on screen, kept between frames and remade only
+  // when a new snapshot arrives, the interpolation moves them or the view
+  // changes; the buffer is then streamed to the GPU.
+  sf::VertexBuffer vbo{ sf::Points, sf::VertexBuffer::Stream };
+  std::vector<sf::Vertex> vertices{};
+  bool vertices_stale = true;
+  float vertices_alpha = 0.f;
+  sf::FloatRect vertices_view{};
+
+  // Bodies coloured by a per-body quantity, one shade per body, remade with
+  // each snapshot. Level of detail is off meanwhile, as splats have no
+  // quantity of their own.
+  bh::color_t color = config.color;
+  std::vector<float> shades{};
+  bool shades_stale = true;
+
+  // Level of detail: while not interpolating, nodes of the last step's tree
+  // that are narrower than a pixel are drawn as one splat each instead of
+  // their bodies. Splats are remade when the tree or the view changes.
+  bool lod = true;
+  bh::tree_flat_t<T, D> render_tree{};
+  std::vector<sf::Vertex> splats{};
+  bool splats_stale = true;
+  sf::FloatRect splats_view{};
+
+  // Tree overlay: node outlines of the last step's tree, remade when the
+  // tree, the view or the depth changes. Subtree costs are summed once per
+  // tree.
+  bool overlay = config.tree_overlay;
+  int overlay_depth = config.tree_depth;
+  std::vector<double> subtree_cost{};
+  std::vector<sf::Vertex> overlay_lines{};
+  bool overlay_stale = true;
+  bool subtree_stale = true;
+  sf::FloatRect overlay_view{};
+
+  // Density map: bodies deposited on a grid of window pixels on the CPU,
+  // where interpolation puts them, tone mapped and uploaded as one texture
+  // instead of blended points.
+  bool density = config.density;
+  std::vector<float> density_grid{};
+  std::vector<std::uint8_t> density_pixels{};
+  sf::Texture density_texture{};
+  density_texture.create (width, height);
+  bool density_stale = true;
+  float density_alpha = 0.f;
+  sf::FloatRect density_view{};
+
+  // Whichever of `vertices` and `splats` is in `vbo`.
+  const std::vector<sf::Vertex> *uploaded = NULL;
+
+  bh::simulation_t<T, D> sim{};
+  sim.pool = bh::task_pool_init (
+      config.threads > 0 ? config.threads : omp_get_max_threads (),
+      config.pin_threads);
+
+  for (int axis = 0; axis < D; ++axis)
+    sim.boundary.corner[axis] = -config.box;
+  sim.boundary.width = config.box * 2;
+  sim.params = config.params;
+
+  bh::point_vector_t<T, D> points{};
+  bh::trajectory_reader_t<T, D> *reader = NULL;
+
+  if (!config.replay.empty ())
+    {
+      if (!config.checkpoint.empty ())
+        {
+          fprintf (stderr, "--checkpoint cannot be used with --replay\n");
+          return bh::task_pool_free (sim.pool), 1;
+        }
 
-  sf::VertexArray vao{ sf::Points };
+      reader = bh::trajectory_reader_init<T, D> (config.replay.c_str (),
+                                                 sim.pool);
+      if (reader == NULL || !bh::trajectory_reader_read (reader, 0, &points))
+        {
+          bh::trajectory_reader_free (reader);
+          return bh::task_pool_free (sim.pool), 1;
+        }
+    }
+  else if (!config.restart.empty ())
+    {
+      if (!bh::snapshot_load (config.restart.c_str (), &sim))
+        return bh::task_pool_free (sim.pool), 1;
 
-  std::vector<bh::point_t> points{};
+      // The checkpoint brings its own parameters; explicit options win.
+      bh::config_apply_params (config, &sim.params);
 
-  bh::THETA = 0.5f;
-  bh::GRAVITY_CONSTANT = 1.0f;
-  bh::TIME_STEP = 1.0f;
-  bh::SOFTENING = 1.0f;
+      points = sim.points;
+    }
+  else
+    {
+      if (!config.initial.empty ())
+        {
+          if (!bh::initial_load<T, D> (config.initial.c_str (), sim.pool,
+                                       &points))
+            return bh::task_pool_free (sim.pool), 1;
+        }
+      else if (!config.scenario.empty ())
+        {
+          bh::scenario_t scenario{};
+          if (!bh::scenario_preset (config.scenario.c_str (), config.bodies,
+                                    config.seed, sim.params, &scenario))
+            {
+              fprintf (stderr, "unknown scenario %s\n",
+                       config.scenario.c_str ());
+              return bh::task_pool_free (sim.pool), 1;
+            }
+
+          bh::push_scenario<T, D> (sim.pool, points, scenario, sim.params);
+        }
+      else
+        bh::push_galaxy<T, D> (sim.pool, points, config.bodies, config.seed,
+                               400, 12, 0, 0, 0, 0, 1.0);
 
-  push_galaxy (points, 100'000, 400, 12, 0, 0, 0, 0, 1.0);
+      bh::points_sort_morton<T, D> (sim.pool, &points, sim.boundary);
+    }
+
+  sim.diagnose = config.diagnostics;
+  sim.flatten = reader == NULL;
+  bh::simulation_configure (&sim);
 
   std::mutex points_mutex;
   std::atomic<bool> running{ true };
 
-  std::vector<bh::point_t> points_previous = points;
-  std::vector<bh::point_t> points_current = points;
+  // Parameters and pool size picked with the keys; the sim thread takes them
+  // over before its next step. Guarded by `points_mutex`.
+  bh::params_t tune_params = sim.params;
+  int tune_threads = bh::task_pool_size (sim.pool);
+  std::atomic<bool> tune_pending{ false };
+
+  // Step timings reach the HUD through this ring, so the sim thread never
+  // waits on the window thread for them.
+  bh::metrics_ring_t<bh::metrics_sample_t, 256> metrics{};
+
+  // What the step that produced `points_current` ran with and how long its
+  // phases took, shown in the title bar.
+  bh::params_t params_current = sim.params;
+  int threads_current = tune_threads;
+  bh::phases_t phases_current{};
+
+  bh::point_vector_t<T, D> points_previous{};
+  bh::point_vector_t<T, D> points_current{};
+  bh::points_copy<T, D> (sim.pool, &points_previous, points);
+  bh::points_copy<T, D> (sim.pool, &points_current, points);
+  bh::points_copy<T, D> (sim.pool, &sim.points, points);
+
+  bh::trajectory_writer_t<T, D> *recorder = NULL;
+  if (!config.trajectory.empty () && reader == NULL)
+    {
+      bh::trajectory_options_t options{};
+      options.velocities = config.trajectory_velocities;
+      options.bits = config.trajectory_bits;
+
+      recorder = bh::trajectory_writer_init<T, D> (config.trajectory.c_str (),
+                                                   sim, options);
+      if (recorder == NULL)
+        return bh::task_pool_free (sim.pool), 1;
+    }
 
-  std::vector<bh::point_t> render_previous = points;
-  std::vector<bh::point_t> render_current = points;
+  bh::snapshot_writer_t *writer
+      = !config.checkpoint.empty () ? bh::snapshot_writer_init () : NULL;
+
+  // Snapshots are copied and turned into vertices by a pool of their own, so
+  // the window thread never picks up a force task of the simulation.
+  bh::task_pool_t *render_pool = bh::task_pool_init (
+      config.render_threads > 0 ? config.render_threads
+                                : bh::task_pool_size (sim.pool),
+      false);
+
+  // The tree of the step that produced `points_current`, which was built
+  // over `points_previous`, and the interactions of its bodies.
+  bh::tree_flat_t<T, D> tree_current{};
+  std::vector<unsigned> cost_current{};
+  std::vector<unsigned> cost_staging{};
+  std::vector<unsigned> render_cost{};
+
+  bh::point_vector_t<T, D> render_previous{};
+  bh::point_vector_t<T, D> render_current{};
+  bh::points_copy<T, D> (render_pool, &render_previous, points);
+  bh::points_copy<T, D> (render_pool, &render_current, points);
 
   std::atomic<bool> update_done = 0;
   std::atomic<bool> do_update = 1;
@@ -236,13 +790,27 @@ main ()
   auto prev_sim_time = std::chrono::steady_clock::now ();
   float sim_update_interval;
 
-  sf::View view (sf::FloatRect (-400, -400, 800, 800));
+  sf::View view (sf::FloatRect (-width / 2, -height / 2, width, height));
   float zoom_level = 1.5;
 
   bool do_interpolate = false;
 
+  // Playback position: the frame the sim thread shows next, and the one it
+  // showed last. Stored frames take the place of simulation steps.
+  std::atomic<std::size_t> replay_frame{ 0 };
+  std::atomic<std::size_t> replay_shown{ 0 };
+  std::atomic<bool> replay_paused{ false };
+  std::atomic<float> replay_rate{ 20 };
+  const std::size_t replay_frames
+      = reader != NULL ? bh::trajectory_reader_frames (*reader) : 0;
+  if (replay_frames > 1)
+    replay_frame = 1;
+
   view.zoom (zoom_level);
 
+  const std::uint64_t first_step = sim.steps;
+  bh::diagnostics_t first{};
+
   std::thread sim_thread ([&] () {
     while (running.load ())
       {
@@ -254,27 +822,79 @@ main ()
           }
 
         auto start = std::chrono::steady_clock::now ();
-        std::vector<bh::point_t> local_points;
-        {
-          std::lock_guard<std::mutex> lock (points_mutex);
-          local_points = points_current;
-        }
-
-        bh::quad_node_t *root = bh::quad_node_init (
-            { -QT_SIZE, -QT_SIZE, QT_SIZE * 2, QT_SIZE * 2 });
-        for (const auto &p : local_points)
-          bh::quad_node_insert (root, p);
-        bh::quad_node_compute_mass (root);
 
-#pragma omp parallel for
-        for (size_t i = 0; i < local_points.size (); ++i)
+        if (reader != NULL)
           {
-            bh::quad_node_compute_force (*root, &local_points[i]);
-            local_points[i].position
-                += local_points[i].velocity * bh::TIME_STEP;
+            const std::size_t next = replay_frame.load ();
+            const std::size_t shown = replay_shown.load ();
+            if (next == shown)
+              {
+                std::this_thread::sleep_for (std::chrono::milliseconds (10));
+                continue;
+              }
+
+            std::this_thread::sleep_until (
+                prev_sim_time
+                + std::chrono::duration_cast<std::chrono::nanoseconds> (
+                    std::chrono::duration<float> (1 / replay_rate.load ())));
+
+            start = std::chrono::steady_clock::now ();
+            if (!bh::trajectory_reader_read (reader, next, &sim.points))
+              {
+                replay_paused = true;
+                replay_frame = shown;
+                continue;
+              }
+
+            replay_shown = next;
+
+            // Playback moves on unless the user picked a frame meanwhile.
+            std::size_t expected = next;
+            if (!replay_paused.load () && next + 1 < replay_frames)
+              replay_frame.compare_exchange_strong (expected, next + 1);
           }
+        else
+          {
+            int threads = bh::task_pool_size (sim.pool);
+            {
+              std::lock_guard<std::mutex> lock (points_mutex);
+              bh::points_copy<T, D> (sim.pool, &sim.points, points_current);
+              if (tune_pending.exchange (false))
+                {
+                  sim.params = tune_params;
+                  threads = tune_threads;
+                  bh::simulation_configure (&sim);
+                }
+            }
+
+            // The pool is only replaced between steps, once the tree of the
+            // last one is freed.
+            if (threads != bh::task_pool_size (sim.pool))
+              {
+                bh::simulation_finish (&sim);
+                bh::task_pool_free (sim.pool);
+                sim.pool = bh::task_pool_init (threads, config.pin_threads);
+              }
+
+            bh::simulation_step (&sim);
+
+            if (sim.diagnose)
+              {
+                if (sim.steps == first_step + 1)
+                  first = sim.diagnostics;
+                bh::diagnostics_print (stdout, sim.diagnostics, first);
+              }
+
+            if (writer != NULL && sim.steps % config.checkpoint_every == 0)
+              bh::snapshot_writer_submit (writer, config.checkpoint.c_str (),
+                                          sim);
 
-        bh::quad_node_free (root);
+            if (recorder != NULL
+                && sim.steps % config.trajectory_every == 0)
+              bh::trajectory_writer_push (recorder, sim);
+
+            cost_staging = sim.cost;
+          }
 
         auto now = std::chrono::steady_clock::now ();
 
@@ -286,7 +906,12 @@ main ()
           std::lock_guard<std::mutex> lock (points_mutex);
 
           std::swap (points_previous, points_current);
-          std::swap (points_current, local_points);
+          std::swap (points_current, sim.points);
+          std::swap (tree_current, sim.tree);
+          std::swap (cost_current, cost_staging);
+          params_current = sim.params;
+          threads_current = bh::task_pool_size (sim.pool);
+          phases_current = sim.phases;
 
           last_sim_update = now;
           sim_update_interval = delta;
@@ -294,17 +919,45 @@ main ()
 
         auto end = std::chrono::steady_clock::now ();
 
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (
-            end - start);
+        bh::metrics_sample_t sample{};
+        sample.step = sim.steps;
+        sample.partition = sim.phases.partition;
+        sample.build = sim.phases.build;
+        sample.force = sim.phases.force;
+        sample.teardown = sim.phases.teardown;
+        sample.update
+            = std::chrono::duration<double, std::milli> (end - start).count ();
+        sample.interactions_per_body
+            = sim.points.empty () ? 0
+                                  : double (sim.interactions)
+                                        / double (sim.points.size ());
+        bh::metrics_ring_push (&metrics, sample);
 
         update_done.store (1);
-        printf ("\tupdate %ldms\n", duration.count ());
       }
   });
 
-  sf::Clock delta, fps_clock;
-  float fps_avg = 0;
-  int frame = 0;
+  // Performance HUD: rolling graphs of the step phases (partition, build,
+  // force, teardown), the whole update, the snapshot copy, the frame time,
+  // interactions per body and resident memory.
+  enum
+  {
+    HUD_STEP,
+    HUD_UPDATE,
+    HUD_COPY,
+    HUD_FRAME,
+    HUD_INTERACTIONS,
+    HUD_MEMORY,
+  };
+  bool hud = config.hud;
+  std::vector<hud_graph_t> graphs = {
+    { "STEP MS", "PBFT" }, { "UPDATE MS", "" },
+    { "COPY MS", "" },     { "FRAME MS", "" },
+    { "INTERACTIONS/BODY", "" }, { "MEMORY MB", "" },
+  };
+  std::vector<sf::Vertex> hud_quads{};
+
+  sf::Clock delta, memory_clock;
 
   while (window.isOpen ())
     {
@@ -337,6 +990,108 @@ main ()
                 do_interpolate = !do_interpolate;
                 printf ("do_interpolate=%d\n", do_interpolate);
               }
+
+            if (event.key.code == sf::Keyboard::L)
+              {
+                lod = !lod;
+                printf ("lod=%d\n", lod);
+              }
+
+            if (event.key.code == sf::Keyboard::C)
+              {
+                color = static_cast<bh::color_t> ((color + 1)
+                                                  % (bh::COLOR_COST + 1));
+                shades_stale = true;
+                vertices_stale = true;
+                printf ("color=%d\n", color);
+              }
+
+            // Solver tuning: 1/2 theta, 3/4 time step, 5/6 softening and
+            // 7/8 pool threads, down/up.
+            if (reader == NULL && event.key.code >= sf::Keyboard::Num1
+                && event.key.code <= sf::Keyboard::Num8)
+              {
+                const int key = event.key.code - sf::Keyboard::Num1;
+                const bool up = key % 2 == 1;
+                const int hardware
+                    = std::max (1u, std::thread::hardware_concurrency ());
+
+                std::lock_guard<std::mutex> lock (points_mutex);
+                bh::params_t &p = tune_params;
+                if (key / 2 == 0)
+                  p.theta = std::max (
+                      std::round (p.theta * 20 + (up ? 1 : -1)) / 20, 0.f);
+                else if (key / 2 == 1)
+                  p.time_step *= up ? 1.25f : 0.8f;
+                else if (key / 2 == 2)
+                  p.softening *= up ? 1.25f : 0.8f;
+                else
+                  tune_threads
+                      = std::clamp (tune_threads + (up ? 1 : -1), 1, hardware);
+                tune_pending = true;
+
+                printf ("theta %.2f time_step %.3g softening %.3g "
+                        "threads %d\n",
+                        p.theta, p.time_step, p.softening, tune_threads);
+              }
+
+            if (event.key.code == sf::Keyboard::T)
+              {
+                overlay = !overlay;
+                overlay_stale = true;
+                printf ("overlay=%d\n", overlay);
+              }
+
+            if (event.key.code == sf::Keyboard::LBracket
+                || event.key.code == sf::Keyboard::RBracket)
+              {
+                overlay_depth += event.key.code == sf::Keyboard::RBracket
+                                     ? 1
+                                     : overlay_depth > 0 ? -1 : 0;
+                overlay_stale = true;
+                printf ("overlay_depth=%d\n", overlay_depth);
+              }
+
+            if (event.key.code == sf::Keyboard::H)
+              hud = !hud;
+
+            if (event.key.code == sf::Keyboard::M)
+              {
+                density = !density;
+                density_stale = true;
+                printf ("density=%d\n", density);
+              }
+
+            if (reader != NULL)
+              {
+                const std::size_t shown = replay_shown.load ();
+
+                if (event.key.code == sf::Keyboard::Space)
+                  {
+                    replay_paused = !replay_paused.load ();
+                    if (!replay_paused.load ())
+                      replay_frame = std::min (shown + 1, replay_frames - 1);
+                  }
+                else if (event.key.code == sf::Keyboard::Left)
+                  replay_frame = shown > 0 ? shown - 1 : 0;
+                else if (event.key.code == sf::Keyboard::Right)
+                  replay_frame = std::min (shown + 1, replay_frames - 1);
+                else if (event.key.code == sf::Keyboard::Home)
+                  replay_frame = 0;
+                else if (event.key.code == sf::Keyboard::End)
+                  replay_frame = replay_frames - 1;
+                else if (event.key.code == sf::Keyboard::Up)
+                  replay_rate = std::min (replay_rate.load () * 2, 960.f);
+                else if (event.key.code == sf::Keyboard::Down)
+                  replay_rate = std::max (replay_rate.load () / 2, 0.25f);
+
+                printf ("frame %zu/%zu step %lu rate %.2f%s\n",
+                        replay_frame.load (), replay_frames,
+                        (unsigned long)bh::trajectory_reader_step (
+                            *reader, replay_frame.load ()),
+                        replay_rate.load (),
+                        replay_paused.load () ? " paused" : "");
+              }
           }
       }
 
@@ -362,20 +1117,62 @@ main ()
 
         do_update.store (0);
 
-        render_previous = points_previous;
-        render_current = points_current;
+        char title[256];
+        {
+          std::lock_guard<std::mutex> lock (points_mutex);
+          bh::points_copy<T, D> (render_pool, &render_previous,
+                                 points_previous);
+          bh::points_copy<T, D> (render_pool, &render_current,
+                                 points_current);
+          std::swap (render_tree, tree_current);
+          std::swap (render_cost, cost_current);
+
+          std::snprintf (
+              title, sizeof (title),
+              "Barnes-Hut Simulation | theta %.2f dt %.3g eps %.3g "
+              "threads %d | partition %.1f build %.1f force %.1f "
+              "teardown %.1f ms",
+              params_current.theta, params_current.time_step,
+              params_current.softening, threads_current,
+              phases_current.partition, phases_current.build,
+              phases_current.force, phases_current.teardown);
+        }
+        window.setTitle (title);
+        vertices_stale = true;
+        shades_stale = true;
+        splats_stale = true;
+        overlay_stale = subtree_stale = true;
+        density_stale = true;
         update_done.store (0);
 
         auto end = std::chrono::steady_clock::now ();
 
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (
-            end - start);
-
-        printf ("\tcopy   %ldms\n", duration.count ());
+        hud_push (&graphs[HUD_COPY],
+                  { std::chrono::duration<float, std::milli> (end - start)
+                        .count (),
+                    0, 0, 0 });
 
         do_update.store (1);
       }
 
+    bh::metrics_sample_t sample;
+    while (bh::metrics_ring_pop (&metrics, &sample))
+      {
+        hud_push (&graphs[HUD_STEP],
+                  { float (sample.partition), float (sample.build),
+                    float (sample.force), float (sample.teardown) });
+        hud_push (&graphs[HUD_UPDATE], { float (sample.update), 0, 0, 0 });
+        hud_push (&graphs[HUD_INTERACTIONS],
+                  { float (sample.interactions_per_body), 0, 0, 0 });
+      }
+
+    hud_push (&graphs[HUD_FRAME], { dt * 1000, 0, 0, 0 });
+    if (memory_clock.getElapsedTime ().asSeconds () > 0.5f)
+      {
+        hud_push (&graphs[HUD_MEMORY], { hud_resident_mb (), 0, 0, 0 });
+        memory_clock.restart ();
+      }
+
     float alpha = 0.f;
     {
       auto elapsed
@@ -383,49 +1180,183 @@ main ()
       if (do_interpolate)
         alpha = std::clamp (elapsed / sim_update_interval, 0.f, 1.f);
 
-      vao.clear ();
+      // Only what lies in the view is drawn. The view starts at one world
+      // unit per pixel and zooms from there.
+      const sf::FloatRect visible (view.getCenter () - view.getSize () / 2.f,
+                                   view.getSize ());
+      const float pixel = zoom_level;
+      const bool use_lod = lod && !do_interpolate && color == bh::COLOR_PLAIN
+                           && !render_tree.empty ();
 
-      for (size_t i = 0; i < render_current.size (); ++i)
+      const std::vector<sf::Vertex> *drawn = &vertices;
+      if (density)
         {
-          const auto &prev = render_previous[i].position;
-          const auto &curr = render_current[i].position;
-
-          sf::Vector2f interp_pos = prev + (curr - prev) * alpha;
-
-          sf::Uint8 r = static_cast<sf::Uint8> (92);
-          sf::Uint8 g = static_cast<sf::Uint8> (106);
-          sf::Uint8 b = static_cast<sf::Uint8> (114);
+          if (density_stale || alpha != density_alpha
+              || visible != density_view)
+            {
+              const bh::density_frame_t frame{ visible.left,  visible.top,
+                                               visible.width, visible.height,
+                                               width,         height };
+              bh::density_accumulate<T, D> (render_pool, render_previous,
+                                            render_current, alpha, frame,
+                                            bh::DENSITY_MASS, &density_grid);
+              bh::density_tone_map (render_pool, density_grid, config.tone,
+                                    config.softness, &density_pixels);
+              density_texture.update (density_pixels.data ());
+              density_stale = false;
+              density_alpha = alpha;
+              density_view = visible;
+            }
+
+          drawn = uploaded;
+        }
+      else if (use_lod)
+        {
+          if (splats_stale || visible != splats_view)
+            {
+              view_lod<T, D> (
+                  render_pool, render_tree, pixel,
+                  render_tree[0].total_mass / T (render_current.size ()),
+                  visible, &splats);
+              splats_stale = false;
+              splats_view = visible;
+              uploaded = NULL;
+            }
+
+          drawn = &splats;
+        }
+      else if (vertices_stale || alpha != vertices_alpha
+               || visible != vertices_view)
+        {
+          if (color != bh::COLOR_PLAIN && shades_stale)
+            {
+              view_shades<T, D> (render_pool, color, render_previous,
+                                 render_current, render_tree, render_cost,
+                                 &shades);
+              shades_stale = false;
+            }
+
+          view_bodies<T, D> (
+              render_pool, render_previous, render_current, alpha,
+              color != bh::COLOR_PLAIN ? shades.data () : NULL, visible,
+              &vertices);
+          vertices_stale = false;
+          vertices_alpha = alpha;
+          vertices_view = visible;
+          uploaded = NULL;
+        }
 
-          sf::Uint8 a = static_cast<sf::Uint8> (128);
+      if (overlay && (overlay_stale || visible != overlay_view))
+        {
+          if (subtree_stale)
+            {
+              view_subtree_cost<T, D> (render_pool, render_tree,
+                                       render_previous, render_cost,
+                                       &subtree_cost);
+              subtree_stale = false;
+            }
+
+          view_overlay<T, D> (render_tree, subtree_cost, overlay_depth, pixel,
+                              visible, &overlay_lines);
+          overlay_stale = false;
+          overlay_view = visible;
+        }
 
-          vao.append (sf::Vertex (interp_pos, sf::Color (r, g, b, a)));
+      if (uploaded != drawn && sf::VertexBuffer::isAvailable ())
+        {
+          if (vbo.getVertexCount () < drawn->size ())
+            vbo.create (drawn->size ());
+          if (!drawn->empty ())
+            vbo.update (drawn->data (), drawn->size (), 0);
         }
+      uploaded = drawn;
     }
 
-    window.draw (vao, sf::RenderStates (sf::BlendAdd));
+    // The density map covers the window pixel for pixel. Without vertex
+    // buffer support, the vertices are drawn from client memory.
+    if (density)
+      {
+        window.setView (window.getDefaultView ());
+        window.draw (sf::Sprite (density_texture));
+        window.setView (view);
+      }
+    else if (sf::VertexBuffer::isAvailable ())
+      window.draw (vbo, 0, uploaded->size (), sf::RenderStates (sf::BlendAdd));
+    else
+      window.draw (uploaded->data (), uploaded->size (), sf::Points,
+                   sf::RenderStates (sf::BlendAdd));
+
+    if (overlay && !overlay_lines.empty ())
+      window.draw (overlay_lines.data (), overlay_lines.size (), sf::Lines);
 
     sf::RectangleShape shape;
-    shape.setSize ({ QT_SIZE * 2, QT_SIZE * 2 });
-    shape.setPosition ({ -QT_SIZE, -QT_SIZE });
+    shape.setSize ({ static_cast<float> (sim.boundary.width),
+                     static_cast<float> (sim.boundary.width) });
+    shape.setPosition (view_project (sim.boundary.corner));
     shape.setFillColor (sf::Color::Transparent);
     shape.setOutlineColor (sf::Color::White);
     shape.setOutlineThickness (zoom_level);
     window.draw (shape);
 
-    window.display ();
-
-    fps_avg += (frame++ == 0) ? 0 : 1.0f / dt;
-
-    if (fps_clock.getElapsedTime ().asSeconds () > 1.0)
+    if (hud)
       {
-        printf ("%.2f (%.2f)\n", 1.0 / dt, fps_avg / frame);
-        fps_clock.restart ();
+        hud_build (graphs, &hud_quads);
+        window.setView (window.getDefaultView ());
+        window.draw (hud_quads.data (), hud_quads.size (), sf::Quads);
+        window.setView (view);
       }
+
+    window.display ();
     }
 
   running = false;
   sim_thread.join ();
 
+  bh::trajectory_writer_free (recorder);
+  bh::snapshot_writer_free (writer);
+  bh::trajectory_reader_free (reader);
+  bh::simulation_finish (&sim);
+  bh::task_pool_free (render_pool);
+  bh::task_pool_free (sim.pool);
+
   return 0;
 }
 
+int
+main (int argc, char **argv)
+{
+  bh::config_t config{};
+  if (!bh::config_parse (&config, argc, argv))
+    {
+      bh::config_usage (stderr, argv[0]);
+      return 1;
+    }
+
+  // A replay is shown in the dimension it was recorded in.
+  if (!config.replay.empty ())
+    {
+      bh::trajectory_header_t header;
+      if (!bh::trajectory_probe (config.replay.c_str (), &header))
+        return 1;
+
+      config.dimension = header.dimension;
+    }
+
+  // A restart continues in the precision and dimension of the checkpoint.
+  else if (!config.restart.empty ())
+    {
+      bh::snapshot_header_t header;
+      if (!bh::snapshot_probe (config.restart.c_str (), &header))
+        return 1;
+
+      config.dimension = header.dimension;
+      config.double_precision = header.scalar_size == sizeof (double);
+    }
+
+  if (config.double_precision)
+    return config.dimension == 3 ? viewer_run<double, 3> (config)
+                                 : viewer_run<double, 2> (config);
+
+  return config.dimension == 3 ? viewer_run<float, 3> (config)
+                               : viewer_run<float, 2> (config);
+}
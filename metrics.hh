@@ -0,0 +1,69 @@
+#ifndef BH_METRICS_HH
+#define BH_METRICS_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace bh
+{
+
+// What one step of the solver thread measured.
+struct metrics_sample_t
+{
+  std::uint64_t step;
+
+  // Milliseconds of the step's phases, see `phases_t`, and of the whole
+  // update including taking the bodies in and publishing them.
+  double partition;
+  double build;
+  double force;
+  double teardown;
+  double update;
+
+  double interactions_per_body;
+};
+
+// Fixed ring of samples between one producer and one consumer thread. Both
+// ends only load and store their own index, so neither ever waits; when the
+// ring is full the newest sample is dropped.
+template <typename S, std::size_t N> struct metrics_ring_t
+{
+  static_assert ((N & (N - 1)) == 0, "ring size must be a power of two");
+
+  S samples[N]{};
+
+  // Next slot to write and next slot to read, counting up without wrapping.
+  alignas (64) std::atomic<std::size_t> head{ 0 };
+  alignas (64) std::atomic<std::size_t> tail{ 0 };
+};
+
+template <typename S, std::size_t N>
+static inline bool
+metrics_ring_push (bh::metrics_ring_t<S, N> *ring, const S &sample)
+{
+  const std::size_t head = ring->head.load (std::memory_order_relaxed);
+  if (head - ring->tail.load (std::memory_order_acquire) == N)
+    return false;
+
+  ring->samples[head % N] = sample;
+  ring->head.store (head + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename S, std::size_t N>
+static inline bool
+metrics_ring_pop (bh::metrics_ring_t<S, N> *ring, S *sample)
+{
+  const std::size_t tail = ring->tail.load (std::memory_order_relaxed);
+  if (tail == ring->head.load (std::memory_order_acquire))
+    return false;
+
+  *sample = ring->samples[tail % N];
+  ring->tail.store (tail + 1, std::memory_order_release);
+  return true;
+}
+
+}
+
+#endif
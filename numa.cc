@@ -0,0 +1,100 @@
+#include "numa.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace bh
+{
+
+// Parses a sysfs cpulist such as "0-3,8-11".
+static std::vector<int>
+numa_parse_cpulist (const char *list)
+{
+  std::vector<int> cpus{};
+
+  const char *s = list;
+  while (*s != '\0' && *s != '\n')
+    {
+      char *end;
+      const long first = std::strtol (s, &end, 10);
+      if (end == s)
+        break;
+
+      long last = first;
+      if (*end == '-')
+        {
+          s = end + 1;
+          last = std::strtol (s, &end, 10);
+        }
+
+      for (long cpu = first; cpu <= last; ++cpu)
+        cpus.push_back (static_cast<int> (cpu));
+
+      s = (*end == ',') ? end + 1 : end;
+    }
+
+  return cpus;
+}
+
+bh::numa_topology_t
+numa_topology_detect ()
+{
+  cpu_set_t allowed;
+  CPU_ZERO (&allowed);
+  sched_getaffinity (0, sizeof (allowed), &allowed);
+
+  bh::numa_topology_t topology{};
+
+  for (int node = 0;; ++node)
+    {
+      const std::string path = "/sys/devices/system/node/node"
+                               + std::to_string (node) + "/cpulist";
+
+      FILE *file = std::fopen (path.c_str (), "r");
+      if (file == NULL)
+        break;
+
+      char line[4096] = { 0 };
+      const bool ok = std::fgets (line, sizeof (line), file) != NULL;
+      std::fclose (file);
+
+      if (!ok)
+        continue;
+
+      std::vector<int> cpus{};
+      for (int cpu : bh::numa_parse_cpulist (line))
+        if (cpu < CPU_SETSIZE && CPU_ISSET (cpu, &allowed))
+          cpus.push_back (cpu);
+
+      if (!cpus.empty ())
+        topology.cpus.push_back (cpus);
+    }
+
+  if (topology.cpus.empty ())
+    {
+      std::vector<int> cpus{};
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET (cpu, &allowed))
+          cpus.push_back (cpu);
+
+      topology.cpus.push_back (cpus);
+    }
+
+  return topology;
+}
+
+bool
+numa_pin_thread (int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+
+  return pthread_setaffinity_np (pthread_self (), sizeof (set), &set) == 0;
+}
+
+}
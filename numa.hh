@@ -0,0 +1,85 @@
+#ifndef BH_NUMA_HH
+#define BH_NUMA_HH
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace bh
+{
+
+// CPUs of every NUMA node the process may run on, in node order. Machines
+// without NUMA information report a single node.
+struct numa_topology_t
+{
+  std::vector<std::vector<int> > cpus{};
+};
+
+bh::numa_topology_t numa_topology_detect ();
+
+// Binds the calling thread to `cpu`. Returns false if the kernel refused.
+bool numa_pin_thread (int cpu);
+
+// Allocator whose default construction leaves memory untouched, so the page
+// placement of a freshly resized vector is decided by the first thread that
+// writes each page rather than by the thread that resized it. That thread is
+// only on a known node if it is pinned, see `task_pool_init`.
+template <typename T> struct first_touch_allocator_t
+{
+  static_assert (std::is_trivially_copyable<T>::value,
+                 "first-touch elements must be trivially copyable");
+
+  using value_type = T;
+
+  first_touch_allocator_t () = default;
+
+  template <typename U>
+  first_touch_allocator_t (const first_touch_allocator_t<U> &)
+  {
+  }
+
+  T *
+  allocate (std::size_t n)
+  {
+    return static_cast<T *> (::operator new (n * sizeof (T)));
+  }
+
+  void
+  deallocate (T *p, std::size_t)
+  {
+    ::operator delete (p);
+  }
+
+  template <typename U>
+  void
+  construct (U *)
+  {
+  }
+
+  template <typename U, typename... Args>
+  void
+  construct (U *p, Args &&...args)
+  {
+    ::new (static_cast<void *> (p)) U (std::forward<Args> (args)...);
+  }
+
+  template <typename U>
+  bool
+  operator== (const first_touch_allocator_t<U> &) const
+  {
+    return true;
+  }
+
+  template <typename U>
+  bool
+  operator!= (const first_touch_allocator_t<U> &) const
+  {
+    return false;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef BH_RANDOM_HH
+#define BH_RANDOM_HH
+
+#include <cstdint>
+
+namespace bh
+{
+
+// Four 32-bit random words.
+struct random_block_t
+{
+  std::uint32_t v[4];
+};
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"). A pure function of `counter` and `key`: body i of a run seeded with
+// `key` always draws block i, whichever thread generates it and in whatever
+// order, so initial conditions are reproducible at any thread count.
+static inline bh::random_block_t
+random_philox (std::uint64_t counter, std::uint64_t key,
+               std::uint32_t stream = 0)
+{
+  std::uint32_t c[4] = { static_cast<std::uint32_t> (counter),
+                         static_cast<std::uint32_t> (counter >> 32), stream,
+                         0 };
+  std::uint32_t k[2] = { static_cast<std::uint32_t> (key),
+                         static_cast<std::uint32_t> (key >> 32) };
+
+  for (int round = 0; round < 10; ++round)
+    {
+      const std::uint64_t p0 = std::uint64_t (0xD2511F53) * c[0];
+      const std::uint64_t p1 = std::uint64_t (0xCD9E8D57) * c[2];
+
+      const std::uint32_t next[4]
+          = { static_cast<std::uint32_t> (p1 >> 32) ^ c[1] ^ k[0],
+              static_cast<std::uint32_t> (p1),
+              static_cast<std::uint32_t> (p0 >> 32) ^ c[3] ^ k[1],
+              static_cast<std::uint32_t> (p0) };
+
+      for (int i = 0; i < 4; ++i)
+        c[i] = next[i];
+
+      k[0] += 0x9E3779B9;
+      k[1] += 0xBB67AE85;
+    }
+
+  return { { c[0], c[1], c[2], c[3] } };
+}
+
+// Uniform in [0, 1) with 32 bits of resolution.
+static inline double
+random_unit (std::uint32_t word)
+{
+  return word * (1.0 / 4294967296.0);
+}
+
+}
+
+#endif
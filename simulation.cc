@@ -0,0 +1,629 @@
+#include "simulation.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+namespace bh
+{
+
+// Depth at which the root is pre-split into independently built cells:
+// 64 cells in both 2D and 3D.
+template <int D> static constexpr int SPLIT_DEPTH = 6 / D;
+
+// Force-loop parts go to the NUMA nodes as contiguous blocks of the curve.
+static inline int
+simulation_part_node (bh::task_pool_t *pool, size_t part)
+{
+  const size_t parts = bh::task_pool_size (pool) * 4;
+  return static_cast<int> (part * bh::task_pool_nodes (pool) / parts);
+}
+
+// Milliseconds since `*since`, which moves on to now.
+static inline double
+simulation_lap (std::chrono::steady_clock::time_point *since)
+{
+  const auto now = std::chrono::steady_clock::now ();
+  const double ms
+      = std::chrono::duration<double, std::milli> (now - *since).count ();
+  return *since = now, ms;
+}
+
+// Sorts `keys` by their upper 32 bits with a parallel LSD radix sort, one
+// byte per pass. Every pass is stable, so keys whose upper halves tie stay
+// in their input order; passes in which all keys share their byte are
+// skipped, which is most of them for bodies that fill only part of the box.
+static void
+work_partition_sort (bh::task_pool_t *pool, std::vector<std::uint64_t> *keys,
+                     std::vector<std::uint64_t> *scratch)
+{
+  const size_t n = keys->size ();
+  const size_t chunks
+      = std::min<size_t> (bh::task_pool_size (pool) * 4, n / 4096 + 1);
+  const auto chunk_begin = [&] (size_t c) { return c * n / chunks; };
+
+  scratch->resize (n);
+  std::vector<size_t> counts (chunks * 256);
+
+  for (int shift = 32; shift < 64; shift += 8)
+    {
+      const std::vector<std::uint64_t> &in = *keys;
+      std::fill (counts.begin (), counts.end (), 0);
+
+      bh::task_pool_parallel_for (
+          pool, chunks, 1, [&] (size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c)
+              for (size_t k = chunk_begin (c); k < chunk_begin (c + 1); ++k)
+                counts[c * 256 + ((in[k] >> shift) & 0xff)]++;
+          });
+
+      // Offsets bucket by bucket, and within a bucket chunk by chunk.
+      size_t offset = 0;
+      bool trivial = false;
+      for (int digit = 0; digit < 256; ++digit)
+        {
+          size_t bucket = 0;
+          for (size_t c = 0; c < chunks; ++c)
+            {
+              const size_t count = counts[c * 256 + digit];
+              counts[c * 256 + digit] = offset;
+              offset += count;
+              bucket += count;
+            }
+          trivial = trivial || bucket == n;
+        }
+
+      if (trivial)
+        continue;
+
+      std::vector<std::uint64_t> &out = *scratch;
+      bh::task_pool_parallel_for (
+          pool, chunks, 1, [&] (size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c)
+              for (size_t k = chunk_begin (c); k < chunk_begin (c + 1); ++k)
+                out[counts[c * 256 + ((in[k] >> shift) & 0xff)]++] = in[k];
+          });
+      keys->swap (*scratch);
+    }
+}
+
+// Fills `keys` with the Morton key of every body in its upper half and the
+// body's index in its lower half.
+template <typename T, int D>
+static void
+morton_keys (bh::task_pool_t *pool, const bh::point_vector_t<T, D> &points,
+             const bh::box_t<T, D> &boundary, std::vector<std::uint64_t> *keys)
+{
+  keys->resize (points.size ());
+  bh::task_pool_parallel_for (
+      pool, points.size (), 4096, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+          (*keys)[i] = (std::uint64_t)bh::morton_key<T, D> (points[i].position,
+                                                           boundary)
+                           << 32
+                       | i;
+      });
+}
+
+// `cost` holds the interaction count of every body from the previous step,
+// or is empty on the first step, in which case every body weighs the same.
+template <typename T, int D>
+static void
+work_partition_build (bh::task_pool_t *pool, bh::work_partition_t *wp,
+                      const bh::point_vector_t<T, D> &points,
+                      const std::vector<unsigned> &cost,
+                      const bh::box_t<T, D> &boundary, int parts)
+{
+  const size_t n = points.size ();
+
+  auto &keys = wp->keys;
+  bh::morton_keys (pool, points, boundary, &keys);
+
+  // The low halves are the body indices, ascending on input, so sorting by
+  // the Morton keys alone orders the keys completely.
+  bh::work_partition_sort (pool, &keys, &wp->scratch);
+
+  const auto weight = [&] (size_t i) -> std::uint64_t {
+    return cost.size () == n ? cost[i] + 1 : 1;
+  };
+
+  // Order and weight sums per chunk of the curve, then the part bounds: part
+  // p starts after the first body at which the running weight reaches p /
+  // parts of the total, found by the chunk that body lies in.
+  const size_t chunks
+      = std::min<size_t> (bh::task_pool_size (pool) * 4, n / 4096 + 1);
+  const auto chunk_begin = [&] (size_t c) { return c * n / chunks; };
+
+  wp->order.resize (n);
+  std::vector<std::uint64_t> sums (chunks + 1, 0);
+  bh::task_pool_parallel_for (pool, chunks, 1, [&] (size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c)
+      for (size_t k = chunk_begin (c); k < chunk_begin (c + 1); ++k)
+        {
+          wp->order[k] = static_cast<std::uint32_t> (keys[k]);
+          sums[c + 1] += weight (wp->order[k]);
+        }
+  });
+
+  for (size_t c = 0; c < chunks; ++c)
+    sums[c + 1] += sums[c];
+  const std::uint64_t total = sums[chunks];
+
+  wp->bounds.assign (parts + 1, n);
+  wp->bounds[0] = 0;
+  if (total == 0)
+    return;
+
+  bh::task_pool_parallel_for (pool, chunks, 1, [&] (size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c)
+      {
+        std::uint64_t sum = sums[c];
+        int part = static_cast<int> (sum * parts / total) + 1;
+        for (size_t k = chunk_begin (c); k < chunk_begin (c + 1); ++k)
+          {
+            sum += weight (wp->order[k]);
+            while (part < parts && sum * parts >= total * part)
+              wp->bounds[part++] = k + 1;
+          }
+      }
+  });
+}
+
+// Fills `starts` with the first position in `wp.order` of every tree cell
+// `depth` levels below the root, plus a final end marker.
+template <typename T, int D>
+static void
+work_partition_cells (const bh::work_partition_t &wp, int depth,
+                      std::vector<std::size_t> *starts)
+{
+  const size_t cells = size_t{ 1 } << (D * depth);
+  starts->assign (cells + 1, wp.keys.size ());
+
+  size_t k = 0;
+  for (size_t c = 0; c < cells; ++c)
+    {
+      while (k < wp.keys.size () && (wp.keys[k] >> (64 - D * depth)) < c)
+        ++k;
+      (*starts)[c] = k;
+    }
+}
+
+static double
+diagnostics_norm (const double v[3])
+{
+  return std::sqrt (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+void
+diagnostics_print (FILE *out, const bh::diagnostics_t &now,
+                   const bh::diagnostics_t &first)
+{
+  const double energy = now.kinetic + now.potential;
+  const double energy0 = first.kinetic + first.potential;
+  const double angular = bh::diagnostics_norm (now.angular_momentum);
+  const double angular0 = bh::diagnostics_norm (first.angular_momentum);
+
+  fprintf (out,
+           "diagnostics step %lu energy %.9e (%+.2e) kinetic %.6e "
+           "potential %.6e momentum %.3e angular %.9e (%+.2e) virial %.4f\n",
+           (unsigned long)now.step, energy,
+           energy0 != 0 ? (energy - energy0) / std::fabs (energy0) : 0.0,
+           now.kinetic, now.potential, bh::diagnostics_norm (now.momentum),
+           angular, angular0 != 0 ? (angular - angular0) / angular0 : 0.0,
+           now.potential != 0 ? 2 * now.kinetic / -now.potential : 0.0);
+}
+
+// Adds a body of mass `m` at `x` with velocity `v` and potential `phi` per
+// unit mass. Pair potentials are seen from both ends, hence the half.
+template <typename T, int D>
+static inline void
+diagnostics_add (bh::diagnostics_t *d, T m, const bh::vec_t<T, D> &x,
+                 const bh::vec_t<T, D> &v, T phi)
+{
+  d->kinetic += 0.5 * m * bh::dot (v, v);
+  d->potential += 0.5 * m * phi;
+
+  for (int axis = 0; axis < D; ++axis)
+    d->momentum[axis] += m * v[axis];
+
+  d->angular_momentum[2] += m * (x[0] * v[1] - x[1] * v[0]);
+  if constexpr (D == 3)
+    {
+      d->angular_momentum[0] += m * (x[1] * v[2] - x[2] * v[1]);
+      d->angular_momentum[1] += m * (x[2] * v[0] - x[0] * v[2]);
+    }
+}
+
+template <typename T, int D>
+void
+points_copy (bh::task_pool_t *pool, bh::point_vector_t<T, D> *dst,
+             const bh::point_vector_t<T, D> &src)
+{
+  dst->resize (src.size ());
+  bh::task_pool_parallel_for (pool, src.size (), 4096,
+                              [&] (size_t begin, size_t end) {
+                                std::copy (src.begin () + begin,
+                                           src.begin () + end,
+                                           dst->begin () + begin);
+                              });
+}
+
+template <typename T, int D>
+void
+points_sort_morton (bh::task_pool_t *pool, bh::point_vector_t<T, D> *points,
+                    const bh::box_t<T, D> &boundary)
+{
+  std::vector<std::uint64_t> keys{};
+  std::vector<std::uint64_t> scratch{};
+  bh::morton_keys (pool, *points, boundary, &keys);
+  bh::work_partition_sort (pool, &keys, &scratch);
+
+  bh::point_vector_t<T, D> sorted{};
+  sorted.resize (points->size ());
+  bh::task_pool_parallel_for (pool, keys.size (), 4096,
+                              [&] (size_t begin, size_t end) {
+                                for (size_t k = begin; k < end; ++k)
+                                  sorted[k] = (*points)[static_cast<
+                                      std::uint32_t> (keys[k])];
+                              });
+  points->swap (sorted);
+}
+
+// Builds the tree over `sim->points` and the force-loop partition that goes
+// with it. The cells at the split depth are left in `cells` so that
+// `simulation_release` can free them in parallel.
+template <typename T, int D>
+static bh::tree_node_t<T, D> *
+simulation_build (bh::simulation_t<T, D> *sim, T theta2,
+                  std::vector<bh::tree_node_t<T, D> *> *cells)
+{
+  constexpr int SPLIT = bh::SPLIT_DEPTH<D>;
+
+  bh::task_pool_t *pool = sim->pool;
+  bh::work_partition_t &partition = sim->partition;
+  bh::point_vector_t<T, D> &points = sim->points;
+
+  auto lap = std::chrono::steady_clock::now ();
+  bh::tree_node_t<T, D> *root = bh::tree_node_init (sim->boundary);
+
+  const int parts = bh::task_pool_size (pool) * 4;
+  bh::work_partition_build (pool, &partition, points, sim->cost,
+                            root->boundary, parts);
+  sim->cost.resize (points.size ());
+  sim->phases.partition = bh::simulation_lap (&lap);
+
+  // Bodies sorted along the Z-order curve fall into the cells of the split
+  // depth as contiguous ranges, so every cell is built and summed by its own
+  // task.
+  std::vector<size_t> starts{};
+  cells->clear ();
+  bh::tree_node_subdivide_to (root, SPLIT);
+  bh::tree_node_collect (root, SPLIT, cells);
+  bh::work_partition_cells<T, D> (partition, SPLIT, &starts);
+
+  std::vector<std::uint32_t> strays{};
+  std::mutex strays_mutex;
+
+  // Cells go to the NUMA node of the part holding their first body, so each
+  // node builds the subtrees its own force walks start in.
+  const auto cell_node = [&] (size_t c) {
+    const auto it = std::upper_bound (partition.bounds.begin (),
+                                      partition.bounds.end (), starts[c]);
+    return bh::simulation_part_node (
+        pool, std::min<size_t> (it - partition.bounds.begin () - 1,
+                                parts - 1));
+  };
+
+  bh::task_group_t build{};
+  for (size_t c = 0; c < cells->size (); ++c)
+    bh::task_pool_submit_on (pool, &build, cell_node (c), [&, c] () {
+      bh::tree_node_t<T, D> *cell = (*cells)[c];
+      for (size_t k = starts[c]; k < starts[c + 1]; ++k)
+        {
+          const size_t i = partition.order[k];
+          if (!bh::tree_node_insert (cell, points[i]))
+            {
+              std::lock_guard<std::mutex> lock (strays_mutex);
+              strays.push_back (i);
+            }
+        }
+      bh::tree_node_compute_mass (cell, theta2);
+    });
+  bh::task_pool_wait (pool, &build);
+
+  // Bodies whose quantized key rounded into a neighbouring cell.
+  for (auto i : strays)
+    bh::tree_node_insert (root, points[i]);
+
+  if (strays.empty ())
+    bh::tree_node_compute_mass_top (root, SPLIT, theta2);
+  else
+    bh::tree_node_compute_mass (root, theta2);
+
+  sim->phases.build = bh::simulation_lap (&lap);
+  return root;
+}
+
+// Copies the tree below `root` into `sim->tree`. The levels above the split
+// depth are written here, leaving room behind them for the nodes below every
+// cell, which tasks added to `group` then fill in parallel.
+template <typename T, int D>
+static void
+simulation_flatten (bh::simulation_t<T, D> *sim,
+                    const bh::tree_node_t<T, D> &root,
+                    const std::vector<bh::tree_node_t<T, D> *> &cells,
+                    bh::task_group_t *group)
+{
+  typedef bh::tree_node_t<T, D> node_t;
+  constexpr int SPLIT = bh::SPLIT_DEPTH<D>;
+
+  bh::task_pool_t *pool = sim->pool;
+  bh::tree_flat_t<T, D> &tree = sim->tree;
+
+  tree.clear ();
+  if (!(root.total_mass > 0))
+    return;
+
+  std::vector<size_t> counts (cells.size ());
+  bh::task_pool_parallel_for (pool, cells.size (), 1,
+                              [&] (size_t begin, size_t end) {
+                                for (size_t c = begin; c < end; ++c)
+                                  counts[c] = bh::tree_node_count (*cells[c]);
+                              });
+
+  const auto count_top = [&] (const auto &self, const node_t &node,
+                              int depth) -> size_t {
+    size_t count = 1;
+    if (depth < SPLIT)
+      for (auto child : node.children)
+        if (child->total_mass > 0)
+          count += self (self, *child, depth + 1);
+    return count;
+  };
+
+  std::vector<size_t> starts (cells.size () + 1);
+  starts[0] = count_top (count_top, root, 0);
+  for (size_t c = 0; c < cells.size (); ++c)
+    starts[c + 1] = starts[c] + counts[c];
+
+  tree.resize (starts.back ());
+  bh::tree_flat_node_t<T, D> *flat = tree.data ();
+
+  size_t next = 1, cell = 0;
+  const auto write_top = [&] (const auto &self, const node_t &node,
+                              size_t slot, int depth) -> void {
+    if (depth == SPLIT)
+      {
+        const node_t *below = cells[cell];
+        const size_t start = starts[cell++];
+        bh::task_pool_submit (pool, group, [below, slot, flat, start] () {
+          size_t next = start;
+          bh::tree_node_flatten (*below, slot, flat, &next);
+        });
+        return;
+      }
+
+    bh::tree_flat_node_t<T, D> &out = flat[slot];
+    out = { node.center_of_mass, node.total_mass, node.boundary, 0, 0 };
+    for (auto child : node.children)
+      out.count += child->total_mass > 0;
+
+    out.first = static_cast<std::uint32_t> (next);
+    next += out.count;
+
+    size_t k = out.first;
+    for (auto child : node.children)
+      if (child->total_mass > 0)
+        self (self, *child, k++, depth + 1);
+      else
+        cell += size_t{ 1 } << (D * (SPLIT - depth - 1));
+  };
+  write_top (write_top, root, 0, 0);
+}
+
+// Frees the tree in the background while the step is published and the next
+// one starts; only the previous teardown is awaited.
+template <typename T, int D>
+static void
+simulation_release (bh::simulation_t<T, D> *sim, bh::tree_node_t<T, D> *root,
+                    const std::vector<bh::tree_node_t<T, D> *> &cells)
+{
+  bh::task_pool_t *pool = sim->pool;
+
+  auto lap = std::chrono::steady_clock::now ();
+  bh::task_pool_wait (pool, &sim->teardown);
+  sim->phases.teardown = bh::simulation_lap (&lap);
+  for (auto cell : cells)
+    bh::task_pool_submit (pool, &sim->teardown,
+                          [cell] () { bh::tree_node_free (cell); });
+  bh::task_pool_submit (pool, &sim->teardown, [root] () {
+    bh::tree_node_free_top (root, bh::SPLIT_DEPTH<D>);
+  });
+}
+
+template <typename T, int D, typename P, bool DIAGNOSE>
+static void
+simulation_step_policy (bh::simulation_t<T, D> *sim)
+{
+  P policy;
+  bh::policy_init (&policy, sim->params);
+
+  bh::task_pool_t *pool = sim->pool;
+  const bh::work_partition_t &partition = sim->partition;
+  bh::point_vector_t<T, D> &points = sim->points;
+  std::vector<unsigned> &cost = sim->cost;
+
+  std::vector<bh::tree_node_t<T, D> *> cells{};
+  bh::tree_node_t<T, D> *root
+      = bh::simulation_build (sim, policy.theta2, &cells);
+
+  const int parts = partition.bounds.size () - 1;
+
+  // Summed per part, then in part order, so that the result does not depend
+  // on the schedule.
+  std::vector<bh::diagnostics_t> sums (DIAGNOSE ? parts : 0);
+  std::vector<std::uint64_t> interactions (parts, 0);
+
+  auto lap = std::chrono::steady_clock::now ();
+  bh::task_group_t force{};
+  if (sim->flatten)
+    bh::simulation_flatten (sim, *root, cells, &force);
+
+  for (int part = 0; part < parts; ++part)
+    bh::task_pool_submit_on (
+        pool, &force, bh::simulation_part_node (pool, part), [&, part] () {
+          std::uint64_t count = 0;
+          for (size_t k = partition.bounds[part];
+               k < partition.bounds[part + 1]; ++k)
+            {
+              const size_t i = partition.order[k];
+              if constexpr (DIAGNOSE)
+                {
+                  const bh::vec_t<T, D> velocity = points[i].velocity;
+                  T potential = 0;
+                  cost[i] = bh::tree_node_compute_force (*root, &points[i],
+                                                         policy, &potential);
+                  bh::diagnostics_add<T, D> (
+                      &sums[part], points[i].mass, points[i].position,
+                      (velocity + points[i].velocity) * T (0.5), potential);
+                }
+              else
+                cost[i] = bh::tree_node_compute_force (*root, &points[i],
+                                                       policy);
+              points[i].position += points[i].velocity * policy.time_step;
+              count += cost[i];
+            }
+          interactions[part] = count;
+        });
+  bh::task_pool_wait (pool, &force);
+  sim->phases.force = bh::simulation_lap (&lap);
+
+  sim->interactions = 0;
+  for (auto count : interactions)
+    sim->interactions += count;
+
+  if constexpr (DIAGNOSE)
+    {
+      bh::diagnostics_t &total = sim->diagnostics;
+      total = {};
+      total.step = sim->steps;
+      for (const auto &sum : sums)
+        {
+          total.kinetic += sum.kinetic;
+          total.potential += sum.potential;
+          for (int axis = 0; axis < 3; ++axis)
+            {
+              total.momentum[axis] += sum.momentum[axis];
+              total.angular_momentum[axis] += sum.angular_momentum[axis];
+            }
+        }
+    }
+
+  bh::simulation_release (sim, root, cells);
+}
+
+template <typename T, int D, bh::kernel_t K>
+static void
+simulation_accelerations_kernel (bh::simulation_t<T, D> *sim,
+                                 std::vector<bh::vec_t<T, D> > *accelerations)
+{
+  // A unit time step turns the kick into the acceleration itself.
+  bh::params_t params = sim->params;
+  params.time_step = 1;
+
+  bh::policy_general_t<T, K> policy;
+  bh::policy_init (&policy, params);
+
+  bh::task_pool_t *pool = sim->pool;
+  const bh::work_partition_t &partition = sim->partition;
+
+  std::vector<bh::tree_node_t<T, D> *> cells{};
+  bh::tree_node_t<T, D> *root
+      = bh::simulation_build (sim, policy.theta2, &cells);
+
+  accelerations->resize (sim->points.size ());
+
+  const int parts = partition.bounds.size () - 1;
+  bh::task_group_t force{};
+  for (int part = 0; part < parts; ++part)
+    bh::task_pool_submit_on (
+        pool, &force, bh::simulation_part_node (pool, part), [&, part] () {
+          for (size_t k = partition.bounds[part];
+               k < partition.bounds[part + 1]; ++k)
+            {
+              const size_t i = partition.order[k];
+              bh::point_t<T, D> probe = sim->points[i];
+              probe.velocity = {};
+              bh::tree_node_compute_force (*root, &probe, policy);
+              (*accelerations)[i] = probe.velocity;
+            }
+        });
+  bh::task_pool_wait (pool, &force);
+
+  bh::simulation_release (sim, root, cells);
+}
+
+template <typename T, int D>
+void
+simulation_accelerations (bh::simulation_t<T, D> *sim,
+                          std::vector<bh::vec_t<T, D> > *accelerations)
+{
+  if (sim->params.kernel == bh::KERNEL_SPLINE)
+    bh::simulation_accelerations_kernel<T, D, bh::KERNEL_SPLINE> (
+        sim, accelerations);
+  else
+    bh::simulation_accelerations_kernel<T, D, bh::KERNEL_PLUMMER> (
+        sim, accelerations);
+}
+
+template <typename T, int D, bool DIAGNOSE>
+static auto
+simulation_select (const bh::params_t &params)
+    -> void (*) (bh::simulation_t<T, D> *)
+{
+  typedef bh::policy_general_t<T, bh::KERNEL_PLUMMER> plummer_t;
+  typedef bh::policy_general_t<T, bh::KERNEL_SPLINE> spline_t;
+
+  if (bh::policy_accepts<T> (NULL, params))
+    return bh::simulation_step_policy<T, D, bh::policy_unit_t<T>, DIAGNOSE>;
+  else if (params.kernel == bh::KERNEL_SPLINE)
+    return bh::simulation_step_policy<T, D, spline_t, DIAGNOSE>;
+  else
+    return bh::simulation_step_policy<T, D, plummer_t, DIAGNOSE>;
+}
+
+template <typename T, int D>
+void
+simulation_configure (bh::simulation_t<T, D> *sim)
+{
+  if (sim->diagnose)
+    sim->step = bh::simulation_select<T, D, true> (sim->params);
+  else
+    sim->step = bh::simulation_select<T, D, false> (sim->params);
+}
+
+template <typename T, int D>
+void
+simulation_step (bh::simulation_t<T, D> *sim)
+{
+  if (sim->step == NULL)
+    bh::simulation_configure (sim);
+
+  sim->step (sim);
+  sim->steps++;
+}
+
+template <typename T, int D>
+void
+simulation_finish (bh::simulation_t<T, D> *sim)
+{
+  bh::task_pool_wait (sim->pool, &sim->teardown);
+}
+
+BH_SIMULATION_INSTANTIATE (, float, 2)
+BH_SIMULATION_INSTANTIATE (, float, 3)
+BH_SIMULATION_INSTANTIATE (, double, 2)
+BH_SIMULATION_INSTANTIATE (, double, 3)
+
+}
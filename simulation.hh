@@ -0,0 +1,148 @@
+#ifndef BH_SIMULATION_HH
+#define BH_SIMULATION_HH
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "force.hh"
+#include "task_pool.hh"
+#include "tree.hh"
+
+namespace bh
+{
+
+// Force-loop schedule: bodies in space-filling order, cut into contiguous
+// ranges of roughly equal cost, several per thread.
+struct work_partition_t
+{
+  std::vector<std::uint64_t> keys{};
+  std::vector<std::uint64_t> scratch{};
+  std::vector<std::uint32_t> order{};
+  std::vector<std::size_t> bounds{};
+};
+
+// Conserved quantities of the bodies as a step found them, measured by its
+// force walk. Velocities are taken half a kick ahead, where the kick-drift
+// integrator keeps them in step with the positions.
+struct diagnostics_t
+{
+  std::uint64_t step;
+  double kinetic;
+  double potential;
+  double momentum[3];
+
+  // About the origin; 2D runs only have the z component.
+  double angular_momentum[3];
+};
+
+// Wall-clock milliseconds of the phases of the last step: ordering the
+// bodies and cutting the force loop into parts, building and summing the
+// tree, the force walk with the drift, and waiting for the tree of the step
+// before to be freed.
+struct phases_t
+{
+  double partition;
+  double build;
+  double force;
+  double teardown;
+};
+
+// One solver instance. `points` holds the bodies that `simulation_step`
+// advances in place; everything else is scratch kept between steps.
+template <typename T, int D> struct simulation_t
+{
+  bh::task_pool_t *pool{ NULL };
+  bh::box_t<T, D> boundary{};
+  bh::point_vector_t<T, D> points{};
+
+  // Steps taken since the initial conditions.
+  std::uint64_t steps{ 0 };
+
+  // `params` takes effect on the next `simulation_configure`, which picks
+  // the `step` specialised for them.
+  bh::params_t params{};
+  void (*step) (bh::simulation_t<T, D> *sim){ NULL };
+
+  // If set when configured, every step also fills `diagnostics`.
+  bool diagnose{ false };
+  bh::diagnostics_t diagnostics{};
+
+  // If set, every step also leaves a copy of its tree in `tree`, built from
+  // the bodies as the step found them; its first node is the root.
+  bool flatten{ false };
+  bh::tree_flat_t<T, D> tree{};
+
+  bh::work_partition_t partition{};
+  std::vector<unsigned> cost{};
+  bh::phases_t phases{};
+
+  // Interactions the force walk of the last step evaluated, over all bodies.
+  std::uint64_t interactions{ 0 };
+
+  // Frees the previous tree while the next step is already running.
+  bh::task_group_t teardown{};
+};
+
+// Writes one line with the energies, momenta and virial ratio 2K/|W| of
+// `now`, and the relative drift of energy and angular momentum since
+// `first`.
+void diagnostics_print (FILE *out, const bh::diagnostics_t &now,
+                        const bh::diagnostics_t &first);
+
+// Copies `src` into `dst` with the same node-blocked split that
+// `task_pool_parallel_for` uses everywhere else, so each NUMA node first
+// touches the part of the body range it goes on to work on.
+template <typename T, int D>
+void points_copy (bh::task_pool_t *pool, bh::point_vector_t<T, D> *dst,
+                  const bh::point_vector_t<T, D> &src);
+
+// Reorders bodies along the Z-order curve, so that contiguous index ranges,
+// and thus the per-node blocks of the body arrays, are also compact in space.
+// Keys are computed once and radix sorted on `pool`.
+template <typename T, int D>
+void points_sort_morton (bh::task_pool_t *pool,
+                         bh::point_vector_t<T, D> *points,
+                         const bh::box_t<T, D> &boundary);
+
+// Selects the fastest force-law policy that is exact for `sim->params`.
+template <typename T, int D>
+void simulation_configure (bh::simulation_t<T, D> *sim);
+
+// Builds the tree over `sim->points`, kicks every body and drifts it by one
+// time step. Configures `sim` first if that has not happened yet.
+template <typename T, int D>
+void simulation_step (bh::simulation_t<T, D> *sim);
+
+// Acceleration of every body of `sim` under `sim->params`, from the same
+// tree a step builds. Nothing is moved; `sim->partition` is rebuilt.
+template <typename T, int D>
+void simulation_accelerations (bh::simulation_t<T, D> *sim,
+                               std::vector<bh::vec_t<T, D> > *accelerations);
+
+// Waits for the background work of the last step.
+template <typename T, int D>
+void simulation_finish (bh::simulation_t<T, D> *sim);
+
+// The engine is compiled for these precisions and dimensions only.
+#define BH_SIMULATION_INSTANTIATE(PREFIX, T, D)                               \
+  PREFIX template void points_copy<T, D> (bh::task_pool_t *,                  \
+                                          bh::point_vector_t<T, D> *,         \
+                                          const bh::point_vector_t<T, D> &);  \
+  PREFIX template void points_sort_morton<T, D> (                             \
+      bh::task_pool_t *, bh::point_vector_t<T, D> *,                          \
+      const bh::box_t<T, D> &);                                               \
+  PREFIX template void simulation_configure<T, D> (bh::simulation_t<T, D> *); \
+  PREFIX template void simulation_step<T, D> (bh::simulation_t<T, D> *);      \
+  PREFIX template void simulation_accelerations<T, D> (                       \
+      bh::simulation_t<T, D> *, std::vector<bh::vec_t<T, D> > *);             \
+  PREFIX template void simulation_finish<T, D> (bh::simulation_t<T, D> *);
+
+BH_SIMULATION_INSTANTIATE (extern, float, 2)
+BH_SIMULATION_INSTANTIATE (extern, float, 3)
+BH_SIMULATION_INSTANTIATE (extern, double, 2)
+BH_SIMULATION_INSTANTIATE (extern, double, 3)
+
+}
+
+#endif
@@ -0,0 +1,391 @@
+#include "snapshot.hh"
+#include "numa.hh"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bh
+{
+
+// Byte image of a whole checkpoint file. Filled in parallel, so its pages
+// are first touched by the pool rather than by the thread that sizes it.
+typedef std::vector<char, bh::first_touch_allocator_t<char> > snapshot_image_t;
+
+static const std::size_t SNAPSHOT_ALIGN = 4096;
+
+static inline std::size_t
+snapshot_align (std::size_t offset)
+{
+  return (offset + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+static bool
+snapshot_valid (const bh::snapshot_header_t &header, const char *path)
+{
+  if (std::memcmp (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic)) != 0)
+    {
+      fprintf (stderr, "snapshot: %s is not a checkpoint\n", path);
+      return false;
+    }
+
+  if (header.version != SNAPSHOT_VERSION)
+    {
+      fprintf (stderr, "snapshot: %s has unsupported version %u\n", path,
+               header.version);
+      return false;
+    }
+
+  if ((header.dimension != 2 && header.dimension != 3)
+      || (header.scalar_size != sizeof (float)
+          && header.scalar_size != sizeof (double)))
+    {
+      fprintf (stderr, "snapshot: %s has an unsupported layout\n", path);
+      return false;
+    }
+
+  if (header.kernel != bh::KERNEL_PLUMMER
+      && header.kernel != bh::KERNEL_SPLINE)
+    {
+      fprintf (stderr, "snapshot: %s has unknown kernel %u\n", path,
+               header.kernel);
+      return false;
+    }
+
+  return true;
+}
+
+bool
+snapshot_probe (const char *path, bh::snapshot_header_t *header)
+{
+  FILE *file = std::fopen (path, "rb");
+  if (file == NULL)
+    {
+      fprintf (stderr, "snapshot: cannot open %s\n", path);
+      return false;
+    }
+
+  const bool ok = std::fread (header, sizeof (*header), 1, file) == 1;
+  std::fclose (file);
+
+  if (!ok)
+    {
+      fprintf (stderr, "snapshot: %s is truncated\n", path);
+      return false;
+    }
+
+  return bh::snapshot_valid (*header, path);
+}
+
+template <typename T, int D>
+static void
+snapshot_encode (const bh::simulation_t<T, D> &sim,
+                 bh::snapshot_image_t *image)
+{
+  const std::size_t n = sim.points.size ();
+
+  bh::snapshot_header_t header{};
+  std::memcpy (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.dimension = D;
+  header.scalar_size = sizeof (T);
+  header.kernel = sim.params.kernel;
+  header.count = n;
+  header.steps = sim.steps;
+  header.theta = sim.params.theta;
+  header.gravity = sim.params.gravity;
+  header.time_step = sim.params.time_step;
+  header.softening = sim.params.softening;
+  for (int axis = 0; axis < D; ++axis)
+    header.corner[axis] = sim.boundary.corner[axis];
+  header.width = sim.boundary.width;
+
+  const int columns = 1 + 2 * D;
+  const std::size_t column_size = n * sizeof (T);
+
+  std::size_t offset = bh::snapshot_align (sizeof (header));
+  for (int c = 0; c < columns; ++c)
+    {
+      header.columns[c] = offset;
+      offset = bh::snapshot_align (offset + column_size);
+    }
+
+  image->resize (offset);
+  char *base = image->data ();
+
+  // Only the padding is zeroed here; the columns are written once, below.
+  std::memcpy (base, &header, sizeof (header));
+  std::memset (base + sizeof (header), 0, header.columns[0] - sizeof (header));
+  for (int c = 0; c < columns; ++c)
+    {
+      const std::size_t end = header.columns[c] + column_size;
+      const std::size_t next = c + 1 < columns ? header.columns[c + 1] : offset;
+      std::memset (base + end, 0, next - end);
+    }
+
+  T *mass = reinterpret_cast<T *> (base + header.columns[0]);
+  T *position[D], *velocity[D];
+  for (int axis = 0; axis < D; ++axis)
+    {
+      position[axis] = reinterpret_cast<T *> (base + header.columns[1 + axis]);
+      velocity[axis]
+          = reinterpret_cast<T *> (base + header.columns[1 + D + axis]);
+    }
+
+  bh::task_pool_parallel_for (
+      sim.pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            const bh::point_t<T, D> &point = sim.points[i];
+            mass[i] = point.mass;
+            for (int axis = 0; axis < D; ++axis)
+              {
+                position[axis][i] = point.position[axis];
+                velocity[axis][i] = point.velocity[axis];
+              }
+          }
+      });
+}
+
+static bool
+snapshot_store (const char *path, const bh::snapshot_image_t &image)
+{
+  const std::string temporary = std::string (path) + ".tmp";
+
+  FILE *file = std::fopen (temporary.c_str (), "wb");
+  if (file == NULL)
+    {
+      fprintf (stderr, "snapshot: cannot create %s\n", temporary.c_str ());
+      return false;
+    }
+
+  bool ok = std::fwrite (image.data (), 1, image.size (), file)
+            == image.size ();
+  ok = std::fflush (file) == 0 && ok;
+  ok = fsync (fileno (file)) == 0 && ok;
+  ok = std::fclose (file) == 0 && ok;
+
+  if (ok && std::rename (temporary.c_str (), path) == 0)
+    return true;
+
+  fprintf (stderr, "snapshot: failed to write %s\n", path);
+  std::remove (temporary.c_str ());
+  return false;
+}
+
+template <typename T, int D>
+bool
+snapshot_write (const char *path, const bh::simulation_t<T, D> &sim)
+{
+  bh::snapshot_image_t image{};
+  bh::snapshot_encode (sim, &image);
+  return bh::snapshot_store (path, image);
+}
+
+// Tells the kernel a file mapping is about to be read front to back. This is
+// only a hint, so a kernel that rejects either advice just reads on demand.
+static void
+snapshot_advise_sequential (void *map, std::size_t size)
+{
+  // The advice values are not flags; each needs its own call, and a refusal
+  // of one says nothing about the other.
+  (void)madvise (map, size, MADV_SEQUENTIAL);
+  (void)madvise (map, size, MADV_WILLNEED);
+}
+
+template <typename T, int D>
+bool
+snapshot_load (const char *path, bh::simulation_t<T, D> *sim)
+{
+  const int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf (stderr, "snapshot: cannot open %s\n", path);
+      return false;
+    }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0
+      || (std::size_t)st.st_size < sizeof (bh::snapshot_header_t))
+    {
+      fprintf (stderr, "snapshot: %s is truncated\n", path);
+      close (fd);
+      return false;
+    }
+
+  const std::size_t size = st.st_size;
+  void *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    {
+      fprintf (stderr, "snapshot: cannot map %s\n", path);
+      return false;
+    }
+
+  bh::snapshot_advise_sequential (map, size);
+
+  const char *base = static_cast<const char *> (map);
+  bh::snapshot_header_t header;
+  std::memcpy (&header, base, sizeof (header));
+
+  bool ok = bh::snapshot_valid (header, path);
+  if (ok && (header.dimension != D || header.scalar_size != sizeof (T)))
+    {
+      fprintf (stderr, "snapshot: %s holds %uD %s data\n", path,
+               header.dimension, header.scalar_size == 8 ? "double" : "float");
+      ok = false;
+    }
+
+  const std::size_t n = header.count;
+  for (int c = 0; ok && c < 1 + 2 * D; ++c)
+    if (header.columns[c] % sizeof (T) != 0
+        || header.columns[c] > size
+        || n > (size - header.columns[c]) / sizeof (T))
+      {
+        fprintf (stderr, "snapshot: %s is truncated\n", path);
+        ok = false;
+      }
+
+  if (ok)
+    {
+      const T *mass = reinterpret_cast<const T *> (base + header.columns[0]);
+      const T *position[D], *velocity[D];
+      for (int axis = 0; axis < D; ++axis)
+        {
+          position[axis]
+              = reinterpret_cast<const T *> (base + header.columns[1 + axis]);
+          velocity[axis] = reinterpret_cast<const T *> (
+              base + header.columns[1 + D + axis]);
+        }
+
+      sim->points.resize (n);
+      bh::task_pool_parallel_for (
+          sim->pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i)
+              {
+                bh::point_t<T, D> &point = sim->points[i];
+                point.mass = mass[i];
+                for (int axis = 0; axis < D; ++axis)
+                  {
+                    point.position[axis] = position[axis][i];
+                    point.velocity[axis] = velocity[axis][i];
+                  }
+              }
+          });
+
+      sim->steps = header.steps;
+      sim->params.theta = header.theta;
+      sim->params.gravity = header.gravity;
+      sim->params.time_step = header.time_step;
+      sim->params.softening = header.softening;
+      sim->params.kernel = static_cast<bh::kernel_t> (header.kernel);
+      for (int axis = 0; axis < D; ++axis)
+        sim->boundary.corner[axis] = header.corner[axis];
+      sim->boundary.width = header.width;
+      sim->step = NULL;
+    }
+
+  munmap (map, size);
+  return ok;
+}
+
+struct snapshot_writer_t
+{
+  std::thread thread{};
+  std::mutex mutex{};
+  std::condition_variable cv{};
+
+  bool running{ true };
+  bool busy{ false };
+
+  std::string path{};
+  bh::snapshot_image_t pending{};
+  bh::snapshot_image_t staging{};
+};
+
+static void
+snapshot_writer_main (bh::snapshot_writer_t *writer)
+{
+  std::unique_lock<std::mutex> lock (writer->mutex);
+
+  for (;;)
+    {
+      writer->cv.wait (lock,
+                       [writer] () { return writer->busy || !writer->running; });
+
+      if (!writer->busy)
+        return;
+
+      lock.unlock ();
+      bh::snapshot_store (writer->path.c_str (), writer->pending);
+
+      // Holding the written image until the next checkpoint would keep two
+      // copies of the bodies resident between checkpoints.
+      bh::snapshot_image_t ().swap (writer->pending);
+      lock.lock ();
+
+      writer->busy = false;
+      writer->cv.notify_all ();
+    }
+}
+
+bh::snapshot_writer_t *
+snapshot_writer_init ()
+{
+  auto *writer = new bh::snapshot_writer_t{};
+  writer->thread = std::thread (bh::snapshot_writer_main, writer);
+  return writer;
+}
+
+void
+snapshot_writer_free (bh::snapshot_writer_t *writer)
+{
+  if (writer == NULL)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock (writer->mutex);
+    writer->running = false;
+  }
+  writer->cv.notify_all ();
+  writer->thread.join ();
+
+  delete writer;
+}
+
+template <typename T, int D>
+void
+snapshot_writer_submit (bh::snapshot_writer_t *writer, const char *path,
+                        const bh::simulation_t<T, D> &sim)
+{
+  {
+    std::unique_lock<std::mutex> lock (writer->mutex);
+    writer->cv.wait (lock, [writer] () { return !writer->busy; });
+  }
+
+  bh::snapshot_encode (sim, &writer->staging);
+
+  {
+    std::lock_guard<std::mutex> lock (writer->mutex);
+    std::swap (writer->staging, writer->pending);
+    writer->path = path;
+    writer->busy = true;
+  }
+  writer->cv.notify_all ();
+}
+
+BH_SNAPSHOT_INSTANTIATE (, float, 2)
+BH_SNAPSHOT_INSTANTIATE (, float, 3)
+BH_SNAPSHOT_INSTANTIATE (, double, 2)
+BH_SNAPSHOT_INSTANTIATE (, double, 3)
+
+}
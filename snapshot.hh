@@ -0,0 +1,81 @@
+#ifndef BH_SNAPSHOT_HH
+#define BH_SNAPSHOT_HH
+
+#include <cstdint>
+
+#include "simulation.hh"
+
+namespace bh
+{
+
+#define SNAPSHOT_MAGIC "BHSNAP\0"
+#define SNAPSHOT_VERSION 1
+
+// Checkpoint file layout, version 1: this header, then one column per
+// quantity, each starting on a page boundary so it can be used straight out
+// of a mapping. Columns hold `count` scalars of `scalar_size` bytes in the
+// order mass, position[0..D), velocity[0..D); `columns` gives their byte
+// offsets and is zero past the last one. All values are little endian.
+struct snapshot_header_t
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t dimension;
+  std::uint32_t scalar_size;
+  std::uint32_t kernel;
+  std::uint64_t count;
+  std::uint64_t steps;
+  double theta;
+  double gravity;
+  double time_step;
+  double softening;
+  double corner[3];
+  double width;
+  std::uint64_t columns[7];
+};
+
+// Reads and validates the header of `path`, so the caller can pick the
+// precision and dimension to restart with.
+bool snapshot_probe (const char *path, bh::snapshot_header_t *header);
+
+// Writes `sim` to `path` synchronously. The file is written under a
+// temporary name and renamed, so a crash never leaves a torn checkpoint.
+template <typename T, int D>
+bool snapshot_write (const char *path, const bh::simulation_t<T, D> &sim);
+
+// Maps `path` and restores bodies, parameters, boundary and step count into
+// `sim`, gathering the columns in parallel on `sim->pool`.
+template <typename T, int D>
+bool snapshot_load (const char *path, bh::simulation_t<T, D> *sim);
+
+// Background checkpoint writer. `snapshot_writer_submit` only transposes the
+// bodies into a staging image on the pool; the file is written by the
+// writer's own thread. A submission waits only if the previous checkpoint is
+// still being written.
+struct snapshot_writer_t;
+
+bh::snapshot_writer_t *snapshot_writer_init ();
+
+// Waits for the pending checkpoint, if any.
+void snapshot_writer_free (bh::snapshot_writer_t *writer);
+
+template <typename T, int D>
+void snapshot_writer_submit (bh::snapshot_writer_t *writer, const char *path,
+                             const bh::simulation_t<T, D> &sim);
+
+#define BH_SNAPSHOT_INSTANTIATE(PREFIX, T, D)                                 \
+  PREFIX template bool snapshot_write<T, D> (const char *,                    \
+                                             const bh::simulation_t<T, D> &); \
+  PREFIX template bool snapshot_load<T, D> (const char *,                     \
+                                            bh::simulation_t<T, D> *);        \
+  PREFIX template void snapshot_writer_submit<T, D> (                         \
+      bh::snapshot_writer_t *, const char *, const bh::simulation_t<T, D> &);
+
+BH_SNAPSHOT_INSTANTIATE (extern, float, 2)
+BH_SNAPSHOT_INSTANTIATE (extern, float, 3)
+BH_SNAPSHOT_INSTANTIATE (extern, double, 2)
+BH_SNAPSHOT_INSTANTIATE (extern, double, 3)
+
+}
+
+#endif
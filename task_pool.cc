@@ -0,0 +1,308 @@
+#include "task_pool.hh"
+#include "numa.hh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bh
+{
+
+struct task_t
+{
+  std::function<void ()> run{};
+  bh::task_group_t *group{ NULL };
+};
+
+struct task_deque_t
+{
+  std::mutex mutex{};
+  std::deque<bh::task_t> tasks{};
+};
+
+struct task_pool_t
+{
+  std::vector<std::unique_ptr<bh::task_deque_t> > deques{};
+  std::vector<std::thread> workers{};
+
+  // Per slot: its NUMA node, and the other slots in stealing order.
+  std::vector<int> slot_node{};
+  std::vector<std::vector<int> > victims{};
+
+  // Per node: its slots, and a counter spreading `task_pool_submit_on`.
+  std::vector<std::vector<int> > node_slots{};
+  std::unique_ptr<std::atomic<unsigned>[]> node_next{};
+
+  std::atomic<bool> running{ true };
+  std::atomic<long> queued{ 0 };
+
+  std::mutex sleep_mutex{};
+  std::condition_variable sleep_cv{};
+};
+
+static thread_local const bh::task_pool_t *current_pool = NULL;
+static thread_local int current_slot = -1;
+
+// Workers own slots [0, size - 1); any other thread shares the last slot.
+static inline int
+task_pool_slot (const bh::task_pool_t *pool)
+{
+  if (current_pool == pool)
+    return current_slot;
+  return static_cast<int> (pool->deques.size ()) - 1;
+}
+
+static inline void
+task_pool_push (bh::task_pool_t *pool, bh::task_group_t *group, int slot,
+                std::function<void ()> task)
+{
+  group->pending.fetch_add (1);
+
+  bh::task_deque_t &deque = *pool->deques[slot];
+  {
+    std::lock_guard<std::mutex> lock (deque.mutex);
+    deque.tasks.push_back ({ std::move (task), group });
+  }
+
+  pool->queued.fetch_add (1);
+
+  {
+    std::lock_guard<std::mutex> lock (pool->sleep_mutex);
+  }
+  pool->sleep_cv.notify_one ();
+}
+
+static inline bool
+task_pool_take (bh::task_pool_t *pool, int slot, bh::task_t *task)
+{
+  const auto &victims = pool->victims[slot];
+
+  for (size_t k = 0; k < victims.size (); ++k)
+    {
+      bh::task_deque_t &deque = *pool->deques[victims[k]];
+      std::lock_guard<std::mutex> lock (deque.mutex);
+
+      if (deque.tasks.empty ())
+        continue;
+
+      // Own work is taken newest first, stolen work oldest first: the
+      // oldest tasks are the biggest ones in a recursive split.
+      if (k == 0)
+        {
+          *task = std::move (deque.tasks.back ());
+          deque.tasks.pop_back ();
+        }
+      else
+        {
+          *task = std::move (deque.tasks.front ());
+          deque.tasks.pop_front ();
+        }
+
+      pool->queued.fetch_sub (1);
+      return true;
+    }
+
+  return false;
+}
+
+static inline void
+task_run (bh::task_t *task)
+{
+  task->run ();
+  task->group->pending.fetch_sub (1, std::memory_order_release);
+}
+
+static void
+task_pool_worker (bh::task_pool_t *pool, int slot, int cpu)
+{
+  current_pool = pool;
+  current_slot = slot;
+
+  if (cpu >= 0 && !bh::numa_pin_thread (cpu))
+    std::fprintf (stderr, "task_pool: could not pin slot %d to cpu %d\n",
+                  slot, cpu);
+
+  bh::task_t task{};
+  while (pool->running.load ())
+    {
+      if (bh::task_pool_take (pool, slot, &task))
+        {
+          bh::task_run (&task);
+          continue;
+        }
+
+      std::unique_lock<std::mutex> lock (pool->sleep_mutex);
+      pool->sleep_cv.wait (lock, [pool] () {
+        return pool->queued.load () > 0 || !pool->running.load ();
+      });
+    }
+}
+
+bh::task_pool_t *
+task_pool_init (int threads, bool pin)
+{
+  auto *pool = new bh::task_pool_t{};
+  threads = std::max (threads, 1);
+
+  const bh::numa_topology_t topology = bh::numa_topology_detect ();
+  const int nodes = static_cast<int> (topology.cpus.size ());
+
+  // Hand out CPUs node by node, so consecutive slots share a node and the
+  // slots are split between the nodes in proportion to their CPUs.
+  std::vector<std::pair<int, int> > places{};
+  for (int node = 0; node < nodes; ++node)
+    for (int cpu : topology.cpus[node])
+      places.emplace_back (node, cpu);
+
+  std::vector<int> slot_cpu (threads);
+  for (int i = 0; i < threads; ++i)
+    {
+      const auto &place = places[(size_t)i * places.size () / threads];
+      pool->slot_node.push_back (place.first);
+      slot_cpu[i] = place.second;
+    }
+
+  // Node-targeted tasks only go to workers. The last slot is shared by
+  // whichever threads wait on the pool, which may run anywhere, so it only
+  // steals, unless it is the only slot.
+  const int placed = std::max (threads - 1, 1);
+
+  pool->node_slots.resize (nodes);
+  for (int i = 0; i < placed; ++i)
+    pool->node_slots[pool->slot_node[i]].push_back (i);
+
+  // Nodes are renumbered over those that got a worker; the shared slot
+  // keeps its node if that has one, or else counts as the first.
+  std::vector<int> renumber (nodes, 0);
+  for (int node = 0, kept = 0; node < nodes; ++node)
+    if (!pool->node_slots[node].empty ())
+      renumber[node] = kept++;
+
+  pool->node_slots.erase (
+      std::remove_if (pool->node_slots.begin (), pool->node_slots.end (),
+                      [] (const auto &slots) { return slots.empty (); }),
+      pool->node_slots.end ());
+  for (int i = 0; i < threads; ++i)
+    pool->slot_node[i] = renumber[pool->slot_node[i]];
+
+  pool->node_next.reset (new std::atomic<unsigned>[pool->node_slots.size ()]);
+  for (size_t node = 0; node < pool->node_slots.size (); ++node)
+    pool->node_next[node].store (0);
+
+  for (int i = 0; i < threads; ++i)
+    {
+      std::vector<int> victims{ i };
+      for (int k = 1; k < threads; ++k)
+        if (pool->slot_node[(i + k) % threads] == pool->slot_node[i])
+          victims.push_back ((i + k) % threads);
+      for (int k = 1; k < threads; ++k)
+        if (pool->slot_node[(i + k) % threads] != pool->slot_node[i])
+          victims.push_back ((i + k) % threads);
+
+      pool->victims.push_back (victims);
+      pool->deques.emplace_back (new bh::task_deque_t{});
+    }
+
+  // The last slot belongs to whichever thread waits on the pool and is left
+  // unpinned.
+  for (int i = 0; i < threads - 1; ++i)
+    pool->workers.emplace_back (bh::task_pool_worker, pool, i,
+                                pin ? slot_cpu[i] : -1);
+
+  return pool;
+}
+
+void
+task_pool_free (bh::task_pool_t *pool)
+{
+  if (pool == NULL)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock (pool->sleep_mutex);
+    pool->running.store (false);
+  }
+  pool->sleep_cv.notify_all ();
+
+  for (auto &worker : pool->workers)
+    worker.join ();
+
+  delete pool;
+}
+
+int
+task_pool_size (const bh::task_pool_t *pool)
+{
+  return static_cast<int> (pool->deques.size ());
+}
+
+int
+task_pool_nodes (const bh::task_pool_t *pool)
+{
+  return static_cast<int> (pool->node_slots.size ());
+}
+
+void
+task_pool_submit (bh::task_pool_t *pool, bh::task_group_t *group,
+                  std::function<void ()> task)
+{
+  bh::task_pool_push (pool, group, bh::task_pool_slot (pool),
+                      std::move (task));
+}
+
+void
+task_pool_submit_on (bh::task_pool_t *pool, bh::task_group_t *group,
+                     int node, std::function<void ()> task)
+{
+  const auto &slots = pool->node_slots[node];
+  const unsigned next = pool->node_next[node].fetch_add (1);
+
+  bh::task_pool_push (pool, group, slots[next % slots.size ()],
+                      std::move (task));
+}
+
+void
+task_pool_wait (bh::task_pool_t *pool, bh::task_group_t *group)
+{
+  const int slot = bh::task_pool_slot (pool);
+
+  bh::task_t task{};
+  while (group->pending.load (std::memory_order_acquire) > 0)
+    {
+      if (bh::task_pool_take (pool, slot, &task))
+        bh::task_run (&task);
+      else
+        std::this_thread::yield ();
+    }
+}
+
+void
+task_pool_parallel_for (
+    bh::task_pool_t *pool, std::size_t n, std::size_t grain,
+    const std::function<void (std::size_t, std::size_t)> &body)
+{
+  grain = std::max<std::size_t> (grain, 1);
+
+  const std::size_t chunks = (n + grain - 1) / grain;
+  const std::size_t nodes = pool->node_slots.size ();
+
+  bh::task_group_t group{};
+  for (std::size_t c = 0; c < chunks; ++c)
+    {
+      const std::size_t begin = c * grain;
+      const std::size_t end = std::min (n, begin + grain);
+      const int node = static_cast<int> (c * nodes / chunks);
+      bh::task_pool_submit_on (pool, &group, node, [&body, begin, end] () {
+        body (begin, end);
+      });
+    }
+
+  bh::task_pool_wait (pool, &group);
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef BH_TASK_POOL_HH
+#define BH_TASK_POOL_HH
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+namespace bh
+{
+
+// Counts the tasks of one phase that have not finished yet. A group may be
+// waited on while tasks are still being added to it.
+struct task_group_t
+{
+  std::atomic<long> pending{ 0 };
+};
+
+struct task_pool_t;
+
+// `threads` counts the caller: the pool starts `threads - 1` workers and the
+// thread that calls `task_pool_wait` runs tasks as the last slot. Slots are
+// spread over the NUMA nodes in node order; with `pin` every worker is bound
+// to one CPU of its node. Without `pin` the node of a slot is only a label:
+// the kernel may run its worker anywhere, so none of the placement below
+// holds.
+bh::task_pool_t *task_pool_init (int threads, bool pin);
+
+void task_pool_free (bh::task_pool_t *pool);
+
+int task_pool_size (const bh::task_pool_t *pool);
+
+// Number of NUMA nodes that own at least one worker slot.
+int task_pool_nodes (const bh::task_pool_t *pool);
+
+// Queues `task` on the calling thread's own deque. Idle threads steal from
+// the opposite end of that deque.
+void task_pool_submit (bh::task_pool_t *pool, bh::task_group_t *group,
+                       std::function<void ()> task);
+
+// Queues `task` on a worker slot of NUMA node `node`, so that it runs, and
+// first touches whatever it allocates, on that node unless it is stolen. The
+// shared last slot is never targeted, as its thread is not pinned. Only a
+// pool made with `pin` actually keeps its workers on their nodes.
+void task_pool_submit_on (bh::task_pool_t *pool, bh::task_group_t *group,
+                          int node, std::function<void ()> task);
+
+// Runs and steals tasks until every task of `group` has finished. Work is
+// stolen from slots of the same node before crossing to another node.
+void task_pool_wait (bh::task_pool_t *pool, bh::task_group_t *group);
+
+// Splits [0, n) into chunks of at most `grain` indices, runs them as tasks of
+// one group and waits for that group. The chunks are handed to the NUMA nodes
+// as contiguous blocks, so the same range always lands on the same node.
+void task_pool_parallel_for (
+    bh::task_pool_t *pool, std::size_t n, std::size_t grain,
+    const std::function<void (std::size_t, std::size_t)> &body);
+
+}
+
+#endif
@@ -0,0 +1,779 @@
+#include "trajectory.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace bh
+{
+
+template <typename T, int D> struct trajectory_slot_t
+{
+  std::uint64_t step{ 0 };
+  bh::point_vector_t<T, D> points{};
+};
+
+template <typename T, int D> struct trajectory_writer_t
+{
+  std::thread thread{};
+  std::mutex mutex{};
+  std::condition_variable cv{};
+  bool running{ true };
+
+  // Slot indices owned by the caller (`idle`) or waiting for the writer
+  // thread (`queued`), oldest first.
+  std::vector<bh::trajectory_slot_t<T, D> > slots{};
+  std::vector<int> idle{};
+  std::deque<int> queued{};
+  std::uint64_t dropped{ 0 };
+
+  // Only touched by the writer thread from here on.
+  FILE *file{ NULL };
+  bool failed{ false };
+  std::uint64_t offset{ 0 };
+  std::uint64_t frames{ 0 };
+  std::vector<std::uint64_t> index{};
+
+  bh::trajectory_header_t header{};
+  int columns{ D };
+  double scale{ 0 };
+
+  // Quantized values of the last frame written, column after column.
+  std::vector<std::int64_t> previous{};
+  std::vector<unsigned char> raw{};
+  std::vector<unsigned char> compressed{};
+};
+
+static inline unsigned char *
+trajectory_put_varint (unsigned char *out, std::int64_t value)
+{
+  auto v = (static_cast<std::uint64_t> (value) << 1)
+           ^ static_cast<std::uint64_t> (value >> 63);
+  while (v >= 0x80)
+    {
+      *out++ = static_cast<unsigned char> (v | 0x80);
+      v >>= 7;
+    }
+
+  *out++ = static_cast<unsigned char> (v);
+  return out;
+}
+
+template <typename T, int D>
+static inline std::int64_t
+trajectory_quantize (const bh::trajectory_writer_t<T, D> &writer,
+                     const bh::point_t<T, D> &point, int column)
+{
+  const bh::trajectory_header_t &header = writer.header;
+
+  if (column < D)
+    {
+      const double f = (point.position[column] - header.corner[column])
+                       / header.width;
+      return std::llround (std::clamp (f, 0.0, 1.0) * writer.scale);
+    }
+
+  return std::llround (point.velocity[column - D] / header.velocity_quantum);
+}
+
+template <typename T, int D>
+static bool
+trajectory_put (bh::trajectory_writer_t<T, D> *writer, const void *data,
+                std::size_t size)
+{
+  if (std::fwrite (data, 1, size, writer->file) != size)
+    return false;
+
+  writer->offset += size;
+  return true;
+}
+
+template <typename T, int D>
+static bool
+trajectory_encode (bh::trajectory_writer_t<T, D> *writer,
+                   const bh::trajectory_slot_t<T, D> &slot)
+{
+  const std::size_t n = slot.points.size ();
+  const std::size_t chunk_bodies = writer->header.chunk_bodies;
+  const bool keyframe
+      = writer->frames % writer->header.keyframe_interval == 0;
+
+  bh::trajectory_frame_t frame{};
+  std::memcpy (frame.magic, "FRM", sizeof (frame.magic));
+  frame.flags = keyframe ? bh::TRAJECTORY_KEYFRAME : 0;
+  frame.step = slot.step;
+  frame.chunks = (n + chunk_bodies - 1) / chunk_bodies;
+
+  writer->index.push_back (slot.step);
+  writer->index.push_back (writer->offset);
+
+  if (!bh::trajectory_put (writer, &frame, sizeof (frame)))
+    return false;
+
+  for (std::size_t begin = 0; begin < n; begin += chunk_bodies)
+    {
+      const std::size_t end = std::min (begin + chunk_bodies, n);
+
+      // Ten bytes hold any 64-bit varint.
+      writer->raw.resize ((end - begin) * writer->columns * 10);
+      unsigned char *out = writer->raw.data ();
+
+      for (int c = 0; c < writer->columns; ++c)
+        {
+          std::int64_t *previous = writer->previous.data () + c * n;
+          for (std::size_t i = begin; i < end; ++i)
+            {
+              const std::int64_t q
+                  = bh::trajectory_quantize (*writer, slot.points[i], c);
+              out = bh::trajectory_put_varint (
+                  out, keyframe ? q : q - previous[i]);
+              previous[i] = q;
+            }
+        }
+
+      bh::trajectory_chunk_t chunk{};
+      chunk.bodies = end - begin;
+      chunk.raw_size = out - writer->raw.data ();
+
+      uLongf size = compressBound (chunk.raw_size);
+      writer->compressed.resize (size);
+      if (compress2 (writer->compressed.data (), &size, writer->raw.data (),
+                     chunk.raw_size, Z_BEST_SPEED)
+          != Z_OK)
+        return false;
+
+      chunk.compressed_size = size;
+      if (!bh::trajectory_put (writer, &chunk, sizeof (chunk))
+          || !bh::trajectory_put (writer, writer->compressed.data (), size))
+        return false;
+    }
+
+  ++writer->frames;
+  return true;
+}
+
+template <typename T, int D>
+static void
+trajectory_writer_main (bh::trajectory_writer_t<T, D> *writer)
+{
+  std::unique_lock<std::mutex> lock (writer->mutex);
+
+  for (;;)
+    {
+      writer->cv.wait (lock, [writer] () {
+        return !writer->queued.empty () || !writer->running;
+      });
+
+      if (writer->queued.empty ())
+        return;
+
+      const int slot = writer->queued.front ();
+      writer->queued.pop_front ();
+      lock.unlock ();
+
+      if (!writer->failed
+          && !bh::trajectory_encode (writer, writer->slots[slot]))
+        {
+          fprintf (stderr, "trajectory: write failed, recording stopped\n");
+          writer->failed = true;
+        }
+
+      lock.lock ();
+      writer->idle.push_back (slot);
+    }
+}
+
+template <typename T, int D>
+bh::trajectory_writer_t<T, D> *
+trajectory_writer_init (const char *path, const bh::simulation_t<T, D> &sim,
+                        const bh::trajectory_options_t &options)
+{
+  FILE *file = std::fopen (path, "wb");
+  if (file == NULL)
+    {
+      fprintf (stderr, "trajectory: cannot create %s\n", path);
+      return NULL;
+    }
+
+  auto *writer = new bh::trajectory_writer_t<T, D>{};
+  writer->file = file;
+
+  bh::trajectory_header_t &header = writer->header;
+  std::memcpy (header.magic, TRAJECTORY_MAGIC, sizeof (header.magic));
+  header.version = TRAJECTORY_VERSION;
+  header.dimension = D;
+  header.flags = options.velocities ? bh::TRAJECTORY_VELOCITIES : 0;
+  header.bits = std::clamp (options.bits, 1, 32);
+  header.count = sim.points.size ();
+  header.keyframe_interval = std::max (options.keyframe_interval, 1);
+  header.chunk_bodies = std::max (options.chunk_bodies, 1);
+  for (int axis = 0; axis < D; ++axis)
+    header.corner[axis] = sim.boundary.corner[axis];
+  header.width = sim.boundary.width;
+  header.velocity_quantum = options.velocity_quantum;
+  header.time_step = sim.params.time_step;
+
+  writer->columns = options.velocities ? 2 * D : D;
+  writer->scale = std::ldexp (1.0, header.bits) - 1;
+  writer->previous.resize (writer->columns * header.count);
+
+  writer->slots.resize (std::max (options.queue, 1));
+  for (int slot = writer->slots.size () - 1; slot >= 0; --slot)
+    writer->idle.push_back (slot);
+
+  writer->failed = !bh::trajectory_put (writer, &header, sizeof (header));
+  writer->thread = std::thread (bh::trajectory_writer_main<T, D>, writer);
+  return writer;
+}
+
+template <typename T, int D>
+bool
+trajectory_writer_push (bh::trajectory_writer_t<T, D> *writer,
+                        const bh::simulation_t<T, D> &sim)
+{
+  int slot;
+  {
+    std::lock_guard<std::mutex> lock (writer->mutex);
+    if (writer->idle.empty () || sim.points.size () != writer->header.count)
+      return ++writer->dropped, false;
+
+    slot = writer->idle.back ();
+    writer->idle.pop_back ();
+  }
+
+  writer->slots[slot].step = sim.steps;
+  bh::points_copy<T, D> (sim.pool, &writer->slots[slot].points, sim.points);
+
+  {
+    std::lock_guard<std::mutex> lock (writer->mutex);
+    writer->queued.push_back (slot);
+  }
+  writer->cv.notify_all ();
+  return true;
+}
+
+template <typename T, int D>
+void
+trajectory_writer_free (bh::trajectory_writer_t<T, D> *writer)
+{
+  if (writer == NULL)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock (writer->mutex);
+    writer->running = false;
+  }
+  writer->cv.notify_all ();
+  writer->thread.join ();
+
+  bool ok = !writer->failed;
+  if (ok)
+    {
+      bh::trajectory_trailer_t trailer{};
+      trailer.index_offset = writer->offset;
+      std::memcpy (trailer.magic, TRAJECTORY_INDEX_MAGIC,
+                   sizeof (trailer.magic));
+
+      ok = bh::trajectory_put (writer, &writer->frames,
+                               sizeof (writer->frames))
+           && bh::trajectory_put (writer, writer->index.data (),
+                                  writer->index.size ()
+                                      * sizeof (std::uint64_t))
+           && bh::trajectory_put (writer, &trailer, sizeof (trailer));
+    }
+
+  ok = std::fclose (writer->file) == 0 && ok;
+  if (!ok)
+    fprintf (stderr, "trajectory: failed to finish the file\n");
+
+  if (writer->dropped > 0)
+    fprintf (stderr, "trajectory: dropped %lu frames, the writer fell behind\n",
+             (unsigned long)writer->dropped);
+
+  delete writer;
+}
+
+// Frames past the one being read that are prefetched from disk.
+static const std::size_t TRAJECTORY_WINDOW = 8;
+
+static bool
+trajectory_valid (const bh::trajectory_header_t &header, const char *path)
+{
+  if (std::memcmp (header.magic, TRAJECTORY_MAGIC, sizeof (header.magic)) != 0)
+    {
+      fprintf (stderr, "trajectory: %s is not a trajectory\n", path);
+      return false;
+    }
+
+  if (header.version != TRAJECTORY_VERSION)
+    {
+      fprintf (stderr, "trajectory: %s has unsupported version %u\n", path,
+               header.version);
+      return false;
+    }
+
+  if ((header.dimension != 2 && header.dimension != 3) || header.bits < 1
+      || header.bits > 32 || header.keyframe_interval == 0
+      || header.chunk_bodies == 0)
+    {
+      fprintf (stderr, "trajectory: %s has an unsupported layout\n", path);
+      return false;
+    }
+
+  return true;
+}
+
+bool
+trajectory_probe (const char *path, bh::trajectory_header_t *header)
+{
+  FILE *file = std::fopen (path, "rb");
+  if (file == NULL)
+    {
+      fprintf (stderr, "trajectory: cannot open %s\n", path);
+      return false;
+    }
+
+  const bool ok = std::fread (header, sizeof (*header), 1, file) == 1;
+  std::fclose (file);
+
+  if (!ok)
+    {
+      fprintf (stderr, "trajectory: %s is truncated\n", path);
+      return false;
+    }
+
+  return bh::trajectory_valid (*header, path);
+}
+
+template <typename T, int D> struct trajectory_reader_t
+{
+  bh::task_pool_t *pool{ NULL };
+
+  const unsigned char *base{ NULL };
+  std::size_t size{ 0 };
+
+  bh::trajectory_header_t header{};
+  int columns{ D };
+  double scale{ 0 };
+
+  // Step and file offset of every frame, and whether it is a keyframe.
+  std::vector<std::uint64_t> steps{};
+  std::vector<std::uint64_t> offsets{};
+  std::vector<bool> keyframes{};
+
+  // Quantized values of frame `current`, column after column.
+  std::vector<std::int64_t> state{};
+  std::size_t current{ SIZE_MAX };
+
+  // Mapped range last asked to be resident.
+  std::size_t resident_begin{ 0 };
+  std::size_t resident_end{ 0 };
+};
+
+// Offset just past frame `offset`, or 0 if the frame is damaged or runs past
+// the end of the file.
+template <typename T, int D>
+static std::size_t
+trajectory_frame_end (const bh::trajectory_reader_t<T, D> &reader,
+                      std::size_t offset, bh::trajectory_frame_t *frame)
+{
+  if (reader.size < sizeof (*frame) || offset > reader.size - sizeof (*frame))
+    return 0;
+
+  std::memcpy (frame, reader.base + offset, sizeof (*frame));
+  if (std::memcmp (frame->magic, "FRM", sizeof (frame->magic)) != 0)
+    return 0;
+
+  offset += sizeof (*frame);
+  std::uint64_t bodies = 0;
+  for (std::uint32_t c = 0; c < frame->chunks; ++c)
+    {
+      bh::trajectory_chunk_t chunk;
+      if (offset + sizeof (chunk) > reader.size)
+        return 0;
+
+      std::memcpy (&chunk, reader.base + offset, sizeof (chunk));
+      offset += sizeof (chunk) + chunk.compressed_size;
+      bodies += chunk.bodies;
+      if (offset > reader.size)
+        return 0;
+    }
+
+  return bodies == reader.header.count ? offset : 0;
+}
+
+// Loads the index written on close, or rebuilds it from the frame headers
+// when the writer never got to close the file.
+template <typename T, int D>
+static void
+trajectory_reader_index (bh::trajectory_reader_t<T, D> *reader,
+                         const char *path)
+{
+  bh::trajectory_trailer_t trailer{};
+  if (reader->size >= sizeof (reader->header) + sizeof (trailer))
+    std::memcpy (&trailer, reader->base + reader->size - sizeof (trailer),
+                 sizeof (trailer));
+
+  // The entries, 16 bytes each, must fill the space between the count and
+  // the trailer exactly. Sizes are compared by subtraction, so a damaged
+  // offset or count cannot wrap around.
+  std::uint64_t frames = 0;
+  const std::size_t index_end = reader->size - sizeof (trailer);
+  const bool indexed
+      = std::memcmp (trailer.magic, TRAJECTORY_INDEX_MAGIC,
+                     sizeof (trailer.magic))
+            == 0
+        && trailer.index_offset <= index_end - sizeof (frames)
+        && (std::memcpy (&frames, reader->base + trailer.index_offset,
+                         sizeof (frames)),
+            frames <= (index_end - trailer.index_offset - sizeof (frames)) / 16
+            && trailer.index_offset + sizeof (frames) + frames * 16
+                   == index_end);
+
+  if (indexed)
+    {
+      const unsigned char *entry
+          = reader->base + trailer.index_offset + sizeof (frames);
+      for (std::uint64_t f = 0; f < frames; ++f, entry += 16)
+        {
+          std::uint64_t step, offset;
+          std::memcpy (&step, entry, sizeof (step));
+          std::memcpy (&offset, entry + 8, sizeof (offset));
+
+          bh::trajectory_frame_t frame;
+          if (bh::trajectory_frame_end (*reader, offset, &frame) == 0)
+            break;
+
+          reader->steps.push_back (step);
+          reader->offsets.push_back (offset);
+          reader->keyframes.push_back (frame.flags & bh::TRAJECTORY_KEYFRAME);
+        }
+    }
+  else
+    fprintf (stderr, "trajectory: %s has no index, scanning frames\n", path);
+
+  std::size_t offset = sizeof (reader->header);
+  while (!indexed)
+    {
+      bh::trajectory_frame_t frame;
+      const std::size_t end
+          = bh::trajectory_frame_end (*reader, offset, &frame);
+      if (end == 0)
+        break;
+
+      reader->steps.push_back (frame.step);
+      reader->offsets.push_back (offset);
+      reader->keyframes.push_back (frame.flags & bh::TRAJECTORY_KEYFRAME);
+      offset = end;
+    }
+
+  // Frames before the first keyframe cannot be decoded.
+  while (!reader->keyframes.empty () && !reader->keyframes.front ())
+    {
+      reader->steps.erase (reader->steps.begin ());
+      reader->offsets.erase (reader->offsets.begin ());
+      reader->keyframes.erase (reader->keyframes.begin ());
+    }
+}
+
+template <typename T, int D>
+bh::trajectory_reader_t<T, D> *
+trajectory_reader_init (const char *path, bh::task_pool_t *pool)
+{
+  const int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf (stderr, "trajectory: cannot open %s\n", path);
+      return NULL;
+    }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0
+      || (std::size_t)st.st_size < sizeof (bh::trajectory_header_t))
+    {
+      fprintf (stderr, "trajectory: %s is truncated\n", path);
+      close (fd);
+      return NULL;
+    }
+
+  const std::size_t size = st.st_size;
+  void *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    {
+      fprintf (stderr, "trajectory: cannot map %s\n", path);
+      return NULL;
+    }
+
+  auto *reader = new bh::trajectory_reader_t<T, D>{};
+  reader->pool = pool;
+  reader->base = static_cast<const unsigned char *> (map);
+  reader->size = size;
+  std::memcpy (&reader->header, reader->base, sizeof (reader->header));
+
+  bool ok = bh::trajectory_valid (reader->header, path);
+  if (ok && reader->header.dimension != D)
+    {
+      fprintf (stderr, "trajectory: %s holds %uD data\n", path,
+               reader->header.dimension);
+      ok = false;
+    }
+
+  if (ok)
+    {
+      const bh::trajectory_header_t &header = reader->header;
+      reader->columns
+          = header.flags & bh::TRAJECTORY_VELOCITIES ? 2 * D : D;
+      reader->scale = std::ldexp (1.0, header.bits) - 1;
+      reader->state.resize (reader->columns * header.count);
+
+      // Frames are paged in around the one being read, not ahead of it.
+      madvise (map, size, MADV_RANDOM);
+      bh::trajectory_reader_index (reader, path);
+    }
+
+  if (ok && reader->offsets.empty ())
+    {
+      fprintf (stderr, "trajectory: %s holds no frames\n", path);
+      ok = false;
+    }
+
+  if (!ok)
+    return bh::trajectory_reader_free (reader), nullptr;
+
+  return reader;
+}
+
+template <typename T, int D>
+void
+trajectory_reader_free (bh::trajectory_reader_t<T, D> *reader)
+{
+  if (reader == NULL)
+    return;
+
+  munmap (const_cast<unsigned char *> (reader->base), reader->size);
+  delete reader;
+}
+
+template <typename T, int D>
+std::size_t
+trajectory_reader_frames (const bh::trajectory_reader_t<T, D> &reader)
+{
+  return reader.offsets.size ();
+}
+
+template <typename T, int D>
+std::uint64_t
+trajectory_reader_step (const bh::trajectory_reader_t<T, D> &reader,
+                        std::size_t frame)
+{
+  return reader.steps[frame];
+}
+
+// Keeps the frames from `first` to `last` resident and lets the kernel drop
+// whatever was kept for the previous window.
+template <typename T, int D>
+static void
+trajectory_reader_window (bh::trajectory_reader_t<T, D> *reader,
+                          std::size_t first, std::size_t last)
+{
+  const std::size_t page = sysconf (_SC_PAGESIZE);
+  const std::size_t begin = reader->offsets[first] / page * page;
+  const std::size_t end = last + 1 < reader->offsets.size ()
+                              ? reader->offsets[last + 1]
+                              : reader->size;
+
+  char *base = const_cast<char *> (
+      reinterpret_cast<const char *> (reader->base));
+
+  // Only whole pages outside the new window are released.
+  if (reader->resident_begin < begin)
+    madvise (base + reader->resident_begin,
+             std::min (begin, reader->resident_end) - reader->resident_begin,
+             MADV_DONTNEED);
+
+  const std::size_t tail = (end + page - 1) / page * page;
+  if (reader->resident_end > tail)
+    {
+      const std::size_t from = std::max (tail, reader->resident_begin);
+      madvise (base + from, reader->resident_end - from, MADV_DONTNEED);
+    }
+
+  madvise (base + begin, end - begin, MADV_WILLNEED);
+  reader->resident_begin = begin;
+  reader->resident_end = std::min (tail, reader->size);
+}
+
+// Applies frame `frame` to the decoder state, one task per chunk.
+template <typename T, int D>
+static bool
+trajectory_reader_apply (bh::trajectory_reader_t<T, D> *reader,
+                         std::size_t frame)
+{
+  const std::size_t n = reader->header.count;
+  const bool keyframe = reader->keyframes[frame];
+
+  bh::trajectory_frame_t header;
+  std::memcpy (&header, reader->base + reader->offsets[frame],
+               sizeof (header));
+
+  std::vector<std::size_t> chunks (header.chunks);
+  std::vector<std::size_t> firsts (header.chunks);
+  std::size_t offset = reader->offsets[frame] + sizeof (header);
+  std::size_t first = 0;
+  for (std::uint32_t c = 0; c < header.chunks; ++c)
+    {
+      bh::trajectory_chunk_t chunk;
+      std::memcpy (&chunk, reader->base + offset, sizeof (chunk));
+      chunks[c] = offset;
+      firsts[c] = first;
+      offset += sizeof (chunk) + chunk.compressed_size;
+      first += chunk.bodies;
+    }
+
+  std::atomic<bool> ok{ true };
+  bh::task_pool_parallel_for (
+      reader->pool, header.chunks, 1, [&] (std::size_t begin, std::size_t end) {
+        std::vector<unsigned char> raw{};
+        for (std::size_t c = begin; c < end; ++c)
+          {
+            bh::trajectory_chunk_t chunk;
+            std::memcpy (&chunk, reader->base + chunks[c], sizeof (chunk));
+
+            raw.resize (chunk.raw_size);
+            uLongf size = chunk.raw_size;
+            if (uncompress (raw.data (), &size,
+                            reader->base + chunks[c] + sizeof (chunk),
+                            chunk.compressed_size)
+                    != Z_OK
+                || size != chunk.raw_size)
+              {
+                ok = false;
+                continue;
+              }
+
+            // A varint longer than 10 bytes, or one cut off by the end of
+            // the chunk, means the frame is corrupt.
+            const unsigned char *in = raw.data ();
+            const unsigned char *limit = in + size;
+            bool valid = true;
+            for (int column = 0; valid && column < reader->columns; ++column)
+              {
+                std::int64_t *state
+                    = reader->state.data () + column * n + firsts[c];
+                for (std::uint32_t i = 0; i < chunk.bodies; ++i)
+                  {
+                    std::uint64_t v = 0;
+                    valid = false;
+                    for (int shift = 0; shift < 64 && in < limit; shift += 7)
+                      {
+                        const unsigned char byte = *in++;
+                        v |= std::uint64_t (byte & 0x7f) << shift;
+                        if (byte < 0x80)
+                          {
+                            valid = true;
+                            break;
+                          }
+                      }
+                    if (!valid)
+                      break;
+
+                    const auto value = static_cast<std::int64_t> (
+                        (v >> 1) ^ (~(v & 1) + 1));
+                    state[i] = keyframe ? value : state[i] + value;
+                  }
+              }
+
+            if (!valid)
+              ok = false;
+          }
+      });
+
+  return ok;
+}
+
+template <typename T, int D>
+bool
+trajectory_reader_read (bh::trajectory_reader_t<T, D> *reader,
+                        std::size_t frame, bh::point_vector_t<T, D> *points)
+{
+  const std::size_t frames = reader->offsets.size ();
+  if (frame >= frames)
+    return false;
+
+  std::size_t keyframe = frame;
+  while (!reader->keyframes[keyframe])
+    --keyframe;
+
+  // Continue from the decoded frame when it lies between the keyframe and
+  // the one asked for, as it does during playback.
+  std::size_t from = keyframe;
+  if (reader->current != SIZE_MAX && reader->current >= keyframe
+      && reader->current <= frame)
+    from = reader->current + 1;
+
+  bh::trajectory_reader_window (
+      reader, std::min (from, frame),
+      std::min (frame + bh::TRAJECTORY_WINDOW, frames - 1));
+
+  for (std::size_t f = from; f <= frame; ++f)
+    {
+      if (!bh::trajectory_reader_apply (reader, f))
+        {
+          fprintf (stderr, "trajectory: frame %zu is damaged\n", f);
+          reader->current = SIZE_MAX;
+          return false;
+        }
+
+      reader->current = f;
+    }
+
+  const bh::trajectory_header_t &header = reader->header;
+  const std::size_t n = header.count;
+  const bool velocities = reader->columns > D;
+
+  points->resize (n);
+  bh::task_pool_parallel_for (
+      reader->pool, n, 16384, [&] (std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+          {
+            bh::point_t<T, D> &point = (*points)[i];
+            point.mass = 1;
+            for (int axis = 0; axis < D; ++axis)
+              {
+                const std::int64_t *state = reader->state.data () + axis * n;
+                point.position[axis] = static_cast<T> (
+                    header.corner[axis]
+                    + state[i] / reader->scale * header.width);
+
+                point.velocity[axis]
+                    = velocities
+                          ? static_cast<T> (reader->state[(D + axis) * n + i]
+                                            * header.velocity_quantum)
+                          : T (0);
+              }
+          }
+      });
+
+  return true;
+}
+
+BH_TRAJECTORY_INSTANTIATE (, float, 2)
+BH_TRAJECTORY_INSTANTIATE (, float, 3)
+BH_TRAJECTORY_INSTANTIATE (, double, 2)
+BH_TRAJECTORY_INSTANTIATE (, double, 3)
+
+}
@@ -0,0 +1,174 @@
+#ifndef BH_TRAJECTORY_HH
+#define BH_TRAJECTORY_HH
+
+#include <cstdint>
+
+#include "simulation.hh"
+
+namespace bh
+{
+
+#define TRAJECTORY_MAGIC "BHTRAJ\0"
+#define TRAJECTORY_INDEX_MAGIC "BHTRIDX"
+#define TRAJECTORY_VERSION 1
+
+// Trajectory file layout, version 1 (all values little endian):
+//
+//   trajectory_header_t
+//   frame*            trajectory_frame_t, then `chunks` times a
+//                     trajectory_chunk_t followed by its deflate stream
+//   index             uint64 frame count, then (uint64 step, uint64 offset)
+//                     per frame
+//   trajectory_trailer_t
+//
+// Positions are quantized to `bits` bits per axis across the root box,
+// velocities to multiples of `velocity_quantum`. Every chunk covers a
+// contiguous range of bodies and, once inflated, holds one zigzag varint
+// per body and column, column after column: position axes, then velocity
+// axes if TRAJECTORY_VELOCITIES is set. Keyframes store the quantized values
+// themselves, other frames the difference to the previous frame in the file.
+// The index is only written on close; readers rebuild it by scanning the
+// frame headers when it is missing.
+struct trajectory_header_t
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t dimension;
+  std::uint32_t flags;
+  std::uint32_t bits;
+  std::uint64_t count;
+  std::uint32_t keyframe_interval;
+  std::uint32_t chunk_bodies;
+  double corner[3];
+  double width;
+  double velocity_quantum;
+  double time_step;
+};
+
+enum
+{
+  TRAJECTORY_VELOCITIES = 1 << 0,
+};
+
+enum
+{
+  TRAJECTORY_KEYFRAME = 1 << 0,
+};
+
+struct trajectory_frame_t
+{
+  char magic[4];
+  std::uint32_t flags;
+  std::uint64_t step;
+  std::uint32_t chunks;
+  std::uint32_t reserved;
+};
+
+struct trajectory_chunk_t
+{
+  std::uint32_t bodies;
+  std::uint32_t raw_size;
+  std::uint32_t compressed_size;
+};
+
+struct trajectory_trailer_t
+{
+  std::uint64_t index_offset;
+  char magic[8];
+};
+
+struct trajectory_options_t
+{
+  bool velocities{ false };
+  int bits{ 24 };
+  double velocity_quantum{ 1e-3 };
+  int keyframe_interval{ 64 };
+  int chunk_bodies{ 1 << 18 };
+
+  // Frames that may wait for the writer thread. When all are taken,
+  // `trajectory_writer_push` drops the frame rather than block.
+  int queue{ 4 };
+};
+
+// Background trajectory writer. Quantization, delta coding, compression and
+// IO all run on the writer's own thread; the caller only copies the bodies
+// into a free queue slot.
+template <typename T, int D> struct trajectory_writer_t;
+
+template <typename T, int D>
+bh::trajectory_writer_t<T, D> *
+trajectory_writer_init (const char *path, const bh::simulation_t<T, D> &sim,
+                        const bh::trajectory_options_t &options);
+
+// Queues the current bodies of `sim`. Returns false if the frame was dropped
+// because the queue was full.
+template <typename T, int D>
+bool trajectory_writer_push (bh::trajectory_writer_t<T, D> *writer,
+                             const bh::simulation_t<T, D> &sim);
+
+// Drains the queue, writes the index and closes the file.
+template <typename T, int D>
+void trajectory_writer_free (bh::trajectory_writer_t<T, D> *writer);
+
+// Reads and validates the header of `path`, so the caller can pick the
+// dimension to replay in.
+bool trajectory_probe (const char *path, bh::trajectory_header_t *header);
+
+// Random access to a recorded trajectory. The file is mapped rather than
+// read, and only the frames around the one last decoded are kept resident,
+// so files much larger than memory replay fine.
+template <typename T, int D> struct trajectory_reader_t;
+
+template <typename T, int D>
+bh::trajectory_reader_t<T, D> *trajectory_reader_init (const char *path,
+                                                       bh::task_pool_t *pool);
+
+template <typename T, int D>
+void trajectory_reader_free (bh::trajectory_reader_t<T, D> *reader);
+
+template <typename T, int D>
+std::size_t
+trajectory_reader_frames (const bh::trajectory_reader_t<T, D> &reader);
+
+template <typename T, int D>
+std::uint64_t
+trajectory_reader_step (const bh::trajectory_reader_t<T, D> &reader,
+                        std::size_t frame);
+
+// Decodes `frame` into `points`. Reading the frames in order only inflates
+// one frame each time; any other frame is rebuilt from the keyframe before
+// it. Trajectories hold no masses, so every body gets unit mass, and no
+// velocities unless they were recorded.
+template <typename T, int D>
+bool trajectory_reader_read (bh::trajectory_reader_t<T, D> *reader,
+                             std::size_t frame,
+                             bh::point_vector_t<T, D> *points);
+
+#define BH_TRAJECTORY_INSTANTIATE(PREFIX, T, D)                               \
+  PREFIX template bh::trajectory_writer_t<T, D> *trajectory_writer_init<T, D> ( \
+      const char *, const bh::simulation_t<T, D> &,                           \
+      const bh::trajectory_options_t &);                                      \
+  PREFIX template bool trajectory_writer_push<T, D> (                         \
+      bh::trajectory_writer_t<T, D> *, const bh::simulation_t<T, D> &);       \
+  PREFIX template void trajectory_writer_free<T, D> (                         \
+      bh::trajectory_writer_t<T, D> *);                                       \
+  PREFIX template bh::trajectory_reader_t<T, D> *trajectory_reader_init<T, D> ( \
+      const char *, bh::task_pool_t *);                                       \
+  PREFIX template void trajectory_reader_free<T, D> (                         \
+      bh::trajectory_reader_t<T, D> *);                                       \
+  PREFIX template std::size_t trajectory_reader_frames<T, D> (                \
+      const bh::trajectory_reader_t<T, D> &);                                 \
+  PREFIX template std::uint64_t trajectory_reader_step<T, D> (                \
+      const bh::trajectory_reader_t<T, D> &, std::size_t);                    \
+  PREFIX template bool trajectory_reader_read<T, D> (                         \
+      bh::trajectory_reader_t<T, D> *, std::size_t,                           \
+      bh::point_vector_t<T, D> *);
+
+BH_TRAJECTORY_INSTANTIATE (extern, float, 2)
+BH_TRAJECTORY_INSTANTIATE (extern, float, 3)
+BH_TRAJECTORY_INSTANTIATE (extern, double, 2)
+BH_TRAJECTORY_INSTANTIATE (extern, double, 3)
+
+}
+
+#endif
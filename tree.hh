@@ -0,0 +1,382 @@
+#ifndef BH_TREE_HH
+#define BH_TREE_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "numa.hh"
+#include "vector.hh"
+
+namespace bh
+{
+
+// Axis-aligned square (cube) with its lowest corner at `corner`. Tree cells
+// are always square, so one edge length describes them.
+template <typename T, int D> struct box_t
+{
+  bh::vec_t<T, D> corner{};
+  T width{ 0 };
+};
+
+template <typename T, int D>
+static inline bool
+box_contains (const bh::box_t<T, D> &box, const bh::vec_t<T, D> &position)
+{
+  for (int axis = 0; axis < D; ++axis)
+    {
+      const T p = position[axis];
+      const T lo = box.corner[axis];
+      if (!(p >= lo && p < lo + box.width))
+        return false;
+    }
+
+  return true;
+}
+
+// Child `index` of `box`: bit `axis` of the index selects the upper half
+// along that axis, which for D = 2 is the order top-left, top-right,
+// bottom-left, bottom-right.
+template <typename T, int D>
+static inline bh::box_t<T, D>
+box_child (const bh::box_t<T, D> &box, int index)
+{
+  bh::box_t<T, D> child{ box.corner, box.width / 2 };
+  for (int axis = 0; axis < D; ++axis)
+    if (index & (1 << axis))
+      child.corner[axis] += box.width / 2;
+
+  return child;
+}
+
+template <typename T, int D> struct point_t
+{
+  T mass;
+  bh::vec_t<T, D> position;
+  bh::vec_t<T, D> velocity;
+};
+
+// Body arrays are first touched by the pool threads that work on them, see
+// `points_copy`.
+template <typename T, int D>
+using point_vector_t
+    = std::vector<bh::point_t<T, D>,
+                  bh::first_touch_allocator_t<bh::point_t<T, D> > >;
+
+template <typename T, int D>
+static inline bh::point_t<T, D>
+point_init (T mass, const bh::vec_t<T, D> &position,
+            const bh::vec_t<T, D> &velocity = {})
+{
+  return (bh::point_t<T, D>){ .mass = mass,
+                              .position = position,
+                              .velocity = velocity };
+}
+
+template <typename T, int D> struct tree_node_t
+{
+  static constexpr int CHILDREN = 1 << D;
+
+  alignas (8) T total_mass{ 0 };
+  bh::vec_t<T, D> center_of_mass{};
+
+  // Squared distance beyond which the node is accepted as a whole,
+  // `(width / theta)^2`, set by the upward pass.
+  T open2{ 0 };
+
+  bh::box_t<T, D> boundary{};
+  std::optional<bh::point_t<T, D> > point{};
+  bh::tree_node_t<T, D> *children[CHILDREN]{};
+};
+
+template <typename T, int D>
+static inline bh::tree_node_t<T, D> *
+tree_node_init (const bh::box_t<T, D> &boundary)
+{
+  auto *node = new bh::tree_node_t<T, D>{};
+  return node->boundary = boundary, node;
+}
+
+template <typename T, int D>
+static inline void
+tree_node_free (bh::tree_node_t<T, D> *node)
+{
+  if (node == NULL)
+    return;
+
+  for (auto child : node->children)
+    bh::tree_node_free (child);
+
+  delete node;
+}
+
+template <typename T, int D>
+static inline bool
+tree_node_is_leaf (const bh::tree_node_t<T, D> &node)
+{
+  return node.children[0] == NULL;
+}
+
+template <typename T, int D>
+static inline void
+tree_node_subdivide (bh::tree_node_t<T, D> *node)
+{
+  for (int index = 0; index < bh::tree_node_t<T, D>::CHILDREN; ++index)
+    node->children[index]
+        = bh::tree_node_init (bh::box_child (node->boundary, index));
+}
+
+// Returns whether `point` was stored somewhere below `node`.
+template <typename T, int D>
+static inline bool
+tree_node_insert (bh::tree_node_t<T, D> *node,
+                  const bh::point_t<T, D> &point)
+{
+  if (!bh::box_contains (node->boundary, point.position))
+    return false;
+
+  if (bh::tree_node_is_leaf (*node))
+    {
+      if (!node->point.has_value ())
+        return node->point = point, true;
+
+      // Coincident bodies can never be separated by subdividing; they act
+      // on everything else as a single mass.
+      if (node->point->position == point.position)
+        return node->point->mass += point.mass, true;
+
+      bh::tree_node_subdivide (node);
+
+      const bh::point_t<T, D> save = node->point.value ();
+      node->point.reset ();
+
+      for (auto child : node->children)
+        if (bh::tree_node_insert (child, save))
+          break;
+    }
+
+  for (auto child : node->children)
+    if (bh::tree_node_insert (child, point))
+      return true;
+
+  return false;
+}
+
+// Subdivides the top `depth` levels below `node` unconditionally, so that
+// the cells at that depth can be filled independently. `node` must be empty.
+template <typename T, int D>
+static inline void
+tree_node_subdivide_to (bh::tree_node_t<T, D> *node, int depth)
+{
+  if (depth == 0)
+    return;
+
+  bh::tree_node_subdivide (node);
+  for (auto child : node->children)
+    bh::tree_node_subdivide_to (child, depth - 1);
+}
+
+// Appends the nodes `depth` levels below `node` in Z-order.
+template <typename T, int D>
+static inline void
+tree_node_collect (bh::tree_node_t<T, D> *node, int depth,
+                   std::vector<bh::tree_node_t<T, D> *> *cells)
+{
+  if (depth == 0)
+    return cells->push_back (node);
+
+  for (auto child : node->children)
+    bh::tree_node_collect (child, depth - 1, cells);
+}
+
+// Frees the top `depth` levels below `node`, leaving the cells at that depth
+// to be freed by whoever owns them.
+template <typename T, int D>
+static inline void
+tree_node_free_top (bh::tree_node_t<T, D> *node, int depth)
+{
+  if (depth == 0)
+    return;
+
+  for (auto child : node->children)
+    bh::tree_node_free_top (child, depth - 1);
+
+  delete node;
+}
+
+// `(width / theta)^2` of `node`, or the largest value when theta is zero and
+// every node has to be opened.
+template <typename T, int D>
+static inline T
+tree_node_open2 (const bh::tree_node_t<T, D> &node, T theta2)
+{
+  if (!(theta2 > 0))
+    return std::numeric_limits<T>::max ();
+
+  return node.boundary.width * node.boundary.width / theta2;
+}
+
+// Combines the already computed moments of the children of `node`.
+template <typename T, int D>
+static inline void
+tree_node_accumulate_mass (bh::tree_node_t<T, D> *node, T theta2)
+{
+  node->open2 = bh::tree_node_open2 (*node, theta2);
+  node->center_of_mass = {};
+  node->total_mass = 0;
+
+  for (auto child : node->children)
+    {
+      node->total_mass += child->total_mass;
+      node->center_of_mass += child->center_of_mass * child->total_mass;
+    }
+
+  if (node->total_mass > 0)
+    node->center_of_mass /= node->total_mass;
+}
+
+template <typename T, int D>
+static inline void
+tree_node_compute_mass (bh::tree_node_t<T, D> *node, T theta2)
+{
+  if (bh::tree_node_is_leaf (*node))
+    {
+      if (node->point.has_value ())
+        {
+          node->center_of_mass = node->point->position;
+          node->total_mass = node->point->mass;
+        }
+
+      return;
+    }
+
+  for (auto child : node->children)
+    bh::tree_node_compute_mass (child, theta2);
+
+  bh::tree_node_accumulate_mass (node, theta2);
+}
+
+// Upward pass over the top `depth` levels only, once the cells at that depth
+// have their moments.
+template <typename T, int D>
+static inline void
+tree_node_compute_mass_top (bh::tree_node_t<T, D> *node, int depth,
+                            T theta2)
+{
+  if (depth == 0)
+    return;
+
+  for (auto child : node->children)
+    bh::tree_node_compute_mass_top (child, depth - 1, theta2);
+
+  bh::tree_node_accumulate_mass (node, theta2);
+}
+
+// One node of a tree copied into a single array, for readers that outlive
+// the tree itself. The children that hold mass are stored next to each
+// other from `first` on; leaves have none and are single bodies.
+template <typename T, int D> struct tree_flat_node_t
+{
+  bh::vec_t<T, D> center_of_mass;
+  T total_mass;
+  bh::box_t<T, D> boundary;
+  std::uint32_t first;
+  std::uint32_t count;
+};
+
+template <typename T, int D>
+using tree_flat_t = std::vector<bh::tree_flat_node_t<T, D> >;
+
+// Number of nodes below `node` that hold mass, not counting `node` itself.
+template <typename T, int D>
+static inline std::size_t
+tree_node_count (const bh::tree_node_t<T, D> &node)
+{
+  std::size_t count = 0;
+  if (!bh::tree_node_is_leaf (node))
+    for (auto child : node.children)
+      if (child->total_mass > 0)
+        count += 1 + bh::tree_node_count (*child);
+
+  return count;
+}
+
+// Writes `node` to `flat[self]` and everything below it from `*next` on.
+// The nodes below take exactly `tree_node_count (node)` slots.
+template <typename T, int D>
+static inline void
+tree_node_flatten (const bh::tree_node_t<T, D> &node, std::size_t self,
+                   bh::tree_flat_node_t<T, D> *flat, std::size_t *next)
+{
+  bh::tree_flat_node_t<T, D> &out = flat[self];
+  out = { node.center_of_mass, node.total_mass, node.boundary, 0, 0 };
+
+  if (bh::tree_node_is_leaf (node))
+    return;
+
+  for (auto child : node.children)
+    out.count += child->total_mass > 0;
+
+  out.first = static_cast<std::uint32_t> (*next);
+  *next += out.count;
+
+  std::size_t slot = out.first;
+  for (auto child : node.children)
+    if (child->total_mass > 0)
+      bh::tree_node_flatten (*child, slot++, flat, next);
+}
+
+// Spreads the low 16 bits of `v` so that a zero bit sits between each of
+// them, ready to be interleaved with another spread coordinate.
+static inline std::uint32_t
+morton_spread2 (std::uint32_t v)
+{
+  v &= 0x0000ffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+// Same for the low 10 bits and two zero bits, for three coordinates.
+static inline std::uint32_t
+morton_spread3 (std::uint32_t v)
+{
+  v &= 0x000003ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// Z-order key of `position` inside `boundary`, aligned to the top bit so
+// that the first D bits always select the child of the root. The child order
+// matches `box_child`, so sorting by key visits bodies in tree order.
+template <typename T, int D>
+static inline std::uint32_t
+morton_key (const bh::vec_t<T, D> &position, const bh::box_t<T, D> &boundary)
+{
+  constexpr int BITS = 32 / D;
+  constexpr T SCALE = static_cast<T> ((1u << BITS) - 1);
+
+  std::uint32_t key = 0;
+  for (int axis = 0; axis < D; ++axis)
+    {
+      const T f = (position[axis] - boundary.corner[axis]) / boundary.width;
+      const auto q = static_cast<std::uint32_t> (
+          std::clamp (f, T (0), T (1)) * SCALE);
+      key |= (D == 2 ? bh::morton_spread2 (q) : bh::morton_spread3 (q))
+             << axis;
+    }
+
+  return key << (32 - BITS * D);
+}
+
+}
+
+#endif
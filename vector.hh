@@ -0,0 +1,136 @@
+#ifndef BH_VECTOR_HH
+#define BH_VECTOR_HH
+
+namespace bh
+{
+
+// Fixed-size vector of `D` scalars of type `T`. A plain aggregate, so arrays
+// of it stay trivially copyable and the per-axis loops below unroll and
+// vectorize for any precision.
+template <typename T, int D> struct vec_t
+{
+  T v[D];
+
+  T &
+  operator[] (int axis)
+  {
+    return v[axis];
+  }
+
+  const T &
+  operator[] (int axis) const
+  {
+    return v[axis];
+  }
+};
+
+template <typename T, int D>
+static inline bh::vec_t<T, D> &
+operator+= (bh::vec_t<T, D> &a, const bh::vec_t<T, D> &b)
+{
+  for (int axis = 0; axis < D; ++axis)
+    a[axis] += b[axis];
+  return a;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D> &
+operator-= (bh::vec_t<T, D> &a, const bh::vec_t<T, D> &b)
+{
+  for (int axis = 0; axis < D; ++axis)
+    a[axis] -= b[axis];
+  return a;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D> &
+operator*= (bh::vec_t<T, D> &a, T s)
+{
+  for (int axis = 0; axis < D; ++axis)
+    a[axis] *= s;
+  return a;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D> &
+operator/= (bh::vec_t<T, D> &a, T s)
+{
+  for (int axis = 0; axis < D; ++axis)
+    a[axis] /= s;
+  return a;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D>
+operator+ (bh::vec_t<T, D> a, const bh::vec_t<T, D> &b)
+{
+  return a += b;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D>
+operator- (bh::vec_t<T, D> a, const bh::vec_t<T, D> &b)
+{
+  return a -= b;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D>
+operator- (bh::vec_t<T, D> a)
+{
+  for (int axis = 0; axis < D; ++axis)
+    a[axis] = -a[axis];
+  return a;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D>
+operator* (bh::vec_t<T, D> a, T s)
+{
+  return a *= s;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D>
+operator* (T s, bh::vec_t<T, D> a)
+{
+  return a *= s;
+}
+
+template <typename T, int D>
+static inline bh::vec_t<T, D>
+operator/ (bh::vec_t<T, D> a, T s)
+{
+  return a /= s;
+}
+
+template <typename T, int D>
+static inline bool
+operator== (const bh::vec_t<T, D> &a, const bh::vec_t<T, D> &b)
+{
+  for (int axis = 0; axis < D; ++axis)
+    if (a[axis] != b[axis])
+      return false;
+  return true;
+}
+
+template <typename T, int D>
+static inline bool
+operator!= (const bh::vec_t<T, D> &a, const bh::vec_t<T, D> &b)
+{
+  return !(a == b);
+}
+
+template <typename T, int D>
+static inline T
+dot (const bh::vec_t<T, D> &a, const bh::vec_t<T, D> &b)
+{
+  T sum = 0;
+  for (int axis = 0; axis < D; ++axis)
+    sum += a[axis] * b[axis];
+  return sum;
+}
+
+}
+
+#endif